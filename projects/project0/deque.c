@@ -0,0 +1,149 @@
+/* Implements the deque as a circular buffer that grows geometrically. */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deque.h"
+
+/* Capacity that an empty deque starts with. Capacities are always
+ * powers of two, so that positions wrap around with a mask. */
+#define DEQUE_INITIAL_CAPACITY 16
+
+/* The elements are slots[head], slots[head + 1], ..., slots[head +
+ * size - 1], with positions taken modulo the capacity. */
+struct _deque {
+  queue_element** slots;
+  size_t capacity;  // length of slots, a power of two
+  size_t head;      // position of the front element
+  size_t size;      // number of elements in the deque
+};
+
+deque* deque_create() {
+  deque* d = (deque*) malloc(sizeof(deque));
+  if (d == NULL)
+    return NULL;
+
+  d->slots = (queue_element**) malloc(DEQUE_INITIAL_CAPACITY *
+                                      sizeof(*d->slots));
+  if (d->slots == NULL) {
+    free(d);
+    return NULL;
+  }
+  d->capacity = DEQUE_INITIAL_CAPACITY;
+  d->head = 0;
+  d->size = 0;
+
+  return d;
+}
+
+void deque_destroy(deque* d) {
+  if (d != NULL) {
+    free(d->slots);
+    free(d);
+  }
+}
+
+/* Private: returns the slot index of the element i places from the
+ * front. */
+static inline size_t deque_index(deque* d, size_t i) {
+  return (d->head + i) & (d->capacity - 1);
+}
+
+/* Private: doubles the capacity of the buffer, unwrapping the elements
+ * so that the front one is at slot 0. */
+static void deque_grow(deque* d) {
+  size_t capacity = 2 * d->capacity;
+  queue_element** slots = (queue_element**) malloc(capacity *
+                                                   sizeof(*slots));
+  assert(slots != NULL);
+
+  // copy the part from head to the end of the buffer, then the part
+  // that wrapped around to the start
+  size_t first = d->capacity - d->head;
+  if (first > d->size)
+    first = d->size;
+  memcpy(slots, d->slots + d->head, first * sizeof(*slots));
+  memcpy(slots + first, d->slots, (d->size - first) * sizeof(*slots));
+
+  free(d->slots);
+  d->slots = slots;
+  d->capacity = capacity;
+  d->head = 0;
+}
+
+void deque_push_front(deque* d, queue_element* elem) {
+  assert(d != NULL);
+  if (d->size == d->capacity)
+    deque_grow(d);
+
+  d->head = (d->head - 1) & (d->capacity - 1);
+  d->slots[d->head] = elem;
+  d->size++;
+}
+
+void deque_push_back(deque* d, queue_element* elem) {
+  assert(d != NULL);
+  if (d->size == d->capacity)
+    deque_grow(d);
+
+  d->slots[deque_index(d, d->size)] = elem;
+  d->size++;
+}
+
+bool deque_pop_front(deque* d, queue_element** elem_ptr) {
+  assert(d != NULL);
+  assert(elem_ptr != NULL);
+  if (deque_is_empty(d)) {
+    return false;
+  }
+
+  *elem_ptr = d->slots[d->head];
+  d->head = deque_index(d, 1);
+  d->size--;
+  return true;
+}
+
+bool deque_pop_back(deque* d, queue_element** elem_ptr) {
+  assert(d != NULL);
+  assert(elem_ptr != NULL);
+  if (deque_is_empty(d)) {
+    return false;
+  }
+
+  d->size--;
+  *elem_ptr = d->slots[deque_index(d, d->size)];
+  return true;
+}
+
+bool deque_peek_front(deque* d, queue_element** elem_ptr) {
+  assert(d != NULL);
+  assert(elem_ptr != NULL);
+  if (deque_is_empty(d)) {
+    return false;
+  }
+
+  *elem_ptr = d->slots[d->head];
+  return true;
+}
+
+bool deque_peek_back(deque* d, queue_element** elem_ptr) {
+  assert(d != NULL);
+  assert(elem_ptr != NULL);
+  if (deque_is_empty(d)) {
+    return false;
+  }
+
+  *elem_ptr = d->slots[deque_index(d, d->size - 1)];
+  return true;
+}
+
+bool deque_is_empty(deque* d) {
+  assert(d != NULL);
+  return d->size == 0;
+}
+
+size_t deque_size(deque* d) {
+  assert(d != NULL);
+  return d->size;
+}
@@ -0,0 +1,70 @@
+#ifndef _DEQUE_H_
+#define _DEQUE_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "queue.h"
+
+/* Definitions for a double-ended queue. Elements can be added and
+ * removed at both ends in O(1) time, so a deque can be used as a FIFO
+ * queue, as a LIFO stack, or as both at once: a worker pushes and pops
+ * its own tasks at the back while idle workers take the oldest tasks
+ * from the front. The implementation is a circular buffer that doubles
+ * in size when it fills up, so only growing allocates memory. */
+
+// Forward declaration of the deque struct. The actual definition is in
+// deque.c.
+typedef struct _deque deque;
+
+/*
+ * Creates and returns a new, empty deque.
+ */
+deque* deque_create();
+
+/*
+ * Destroys the deque. The elements themselves are not freed.
+ */
+void deque_destroy(deque* d);
+
+/*
+ * Adds an element to the front of the deque.
+ */
+void deque_push_front(deque* d, queue_element* elem);
+
+/*
+ * Adds an element to the back of the deque.
+ */
+void deque_push_back(deque* d, queue_element* elem);
+
+/* Removes the element at the front of the deque and leaves it in
+ *   elem_ptr. Returns false if the deque was empty.
+ */
+bool deque_pop_front(deque* d, queue_element** elem_ptr);
+
+/* Removes the element at the back of the deque and leaves it in
+ *   elem_ptr. Returns false if the deque was empty.
+ */
+bool deque_pop_back(deque* d, queue_element** elem_ptr);
+
+/* Leaves the element at the front of the deque in elem_ptr without
+ *   removing it. Returns false if the deque is empty.
+ */
+bool deque_peek_front(deque* d, queue_element** elem_ptr);
+
+/* Leaves the element at the back of the deque in elem_ptr without
+ *   removing it. Returns false if the deque is empty.
+ */
+bool deque_peek_back(deque* d, queue_element** elem_ptr);
+
+/*
+ * Returns true if the deque is empty, false otherwise.
+ */
+bool deque_is_empty(deque* d);
+
+/*
+ * Returns number of elements in the deque.
+ */
+size_t deque_size(deque* d);
+
+#endif  // _DEQUE_H_
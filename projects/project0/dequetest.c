@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include "deque.h"
+
+// Use a deque as a work-stealing queue: the owner pushes and pops at
+// the back, a thief takes from the front. Enough elements are pushed
+// that the buffer grows while it is wrapped around.
+void test_owner_and_thief() {
+  deque* d = deque_create();
+  assert(d != NULL);
+  queue_element* elem;
+  uintptr_t stolen = 0;
+  uintptr_t pushed = 0;
+  uintptr_t popped = 0;
+
+  for (int round = 0; round < 100; round++) {
+    for (int i = 0; i < 10; i++)
+      deque_push_back(d, (queue_element*) pushed++);
+
+    // the owner sees its newest task
+    bool popped_back = deque_pop_back(d, &elem);
+    assert(popped_back);
+    assert((uintptr_t) elem == pushed - 1);
+    popped++;
+    deque_push_back(d, elem);
+
+    // the thief takes the oldest tasks, in order
+    for (int i = 0; i < 3; i++) {
+      bool popped_front = deque_pop_front(d, &elem);
+      assert(popped_front);
+      assert((uintptr_t) elem == stolen);
+      stolen++;
+    }
+  }
+  assert(deque_size(d) == pushed - stolen);
+
+  deque_destroy(d);
+}
+
+int main(int argc, char* argv[]) {
+  deque* d = deque_create();
+  queue_element* elem;
+
+  assert(d != NULL);
+  assert(deque_is_empty(d));
+  bool popped = deque_pop_front(d, &elem);
+  assert(!popped);
+  popped = deque_pop_back(d, &elem);
+  assert(!popped);
+  assert(!deque_peek_front(d, &elem));
+  assert(!deque_peek_back(d, &elem));
+
+  // push at both ends, wrapping around the start of the buffer
+  for (uintptr_t i = 0; i < 5; i++) {
+    deque_push_front(d, (queue_element*) (10 - i));
+    deque_push_back(d, (queue_element*) (11 + i));
+  }
+  assert(deque_size(d) == 10);  // d: 6 7 ... 15
+
+  assert(deque_peek_front(d, &elem) && (uintptr_t) elem == 6);
+  assert(deque_peek_back(d, &elem) && (uintptr_t) elem == 15);
+  assert(deque_size(d) == 10);
+
+  // grow the buffer past its initial capacity
+  for (uintptr_t i = 16; i < 100; i++)
+    deque_push_back(d, (queue_element*) i);
+  for (uintptr_t i = 5; i > 0; i--)
+    deque_push_front(d, (queue_element*) i);
+  assert(deque_size(d) == 99);  // d: 1 2 ... 99
+
+  for (uintptr_t i = 1; i <= 50; i++) {
+    popped = deque_pop_front(d, &elem);
+    assert(popped);
+    assert((uintptr_t) elem == i);
+  }
+  for (uintptr_t i = 99; i > 50; i--) {
+    popped = deque_pop_back(d, &elem);
+    assert(popped);
+    assert((uintptr_t) elem == i);
+  }
+  assert(deque_is_empty(d));
+  popped = deque_pop_back(d, &elem);
+  assert(!popped);
+
+  deque_destroy(d);
+
+  test_owner_and_thief();
+
+  printf("dequetest passed\n");
+  return 0;
+}
@@ -0,0 +1,76 @@
+/* Implements the intrusive queue as a circular doubly linked list
+ * threaded through a sentinel link. */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "iqueue.h"
+
+void iqueue_init(iqueue* q) {
+  assert(q != NULL);
+
+  // the sentinel points to itself when the queue is empty
+  q->head.next = &q->head;
+  q->head.prev = &q->head;
+  q->size = 0;
+}
+
+void iqueue_append(iqueue* q, queue_link* link) {
+  assert(q != NULL && link != NULL);
+
+  link->next = &q->head;
+  link->prev = q->head.prev;
+  q->head.prev->next = link;
+  q->head.prev = link;
+  q->size++;
+}
+
+bool iqueue_remove(iqueue* q, queue_link** link_ptr) {
+  assert(q != NULL);
+  assert(link_ptr != NULL);
+  if (iqueue_is_empty(q)) {
+    return false;
+  }
+
+  *link_ptr = q->head.next;
+  iqueue_unlink(q, q->head.next);
+  return true;
+}
+
+void iqueue_unlink(iqueue* q, queue_link* link) {
+  assert(q != NULL && link != NULL && link != &q->head);
+  assert(q->size > 0);
+
+  link->prev->next = link->next;
+  link->next->prev = link->prev;
+  link->next = NULL;
+  link->prev = NULL;
+  q->size--;
+}
+
+bool iqueue_is_empty(iqueue* q) {
+  assert(q != NULL);
+  return q->head.next == &q->head;
+}
+
+size_t iqueue_size(iqueue* q) {
+  assert(q != NULL);
+  return q->size;
+}
+
+bool iqueue_apply(iqueue* q, iqueue_function qf, iqueue_function_args* args) {
+  assert(q != NULL && qf != NULL);
+
+  if (iqueue_is_empty(q))
+    return false;
+
+  // remember the next link first, in case qf unlinks the current one
+  queue_link* next;
+  for (queue_link* cur = q->head.next; cur != &q->head; cur = next) {
+    next = cur->next;
+    if (!qf(cur, args))
+      break;
+  }
+
+  return true;
+}
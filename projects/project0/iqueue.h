@@ -0,0 +1,93 @@
+#ifndef _IQUEUE_H_
+#define _IQUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/* Definitions for an intrusive queue. Instead of the queue allocating a
+ * link for every element it stores, callers embed a queue_link in their
+ * own structs and the queue chains those links together, so the queue
+ * itself never allocates memory. The links are doubly linked, which
+ * makes removing an element from the middle of the queue O(1).
+ *
+ * A link can be on at most one queue at a time. To put one struct on
+ * several queues at once, embed one queue_link per queue.
+ *
+ * Sample client use:
+ *
+   typedef struct {
+     int conn;
+     queue_link link;
+   } request;
+
+   void bar(iqueue* q, request* req) {
+     iqueue_append(q, &req->link);
+
+     queue_link* ql;
+     if (iqueue_remove(q, &ql)) {
+       request* first = iqueue_entry(ql, request, link);
+     }
+   }
+ */
+
+// A link embedded in each element of an intrusive queue.
+typedef struct _queue_link {
+  struct _queue_link* next;
+  struct _queue_link* prev;
+} queue_link;
+
+// An intrusive queue. The struct is public so that it can be embedded in
+// other structs or live on the stack; it must be set up with iqueue_init.
+typedef struct _iqueue {
+  queue_link head;  // sentinel: head.next is the first link
+  size_t size;
+} iqueue;
+
+// Returns a pointer to the struct of the given type that contains link
+// as its member.
+#define iqueue_entry(link, type, member) \
+  ((type*) ((char*) (link) - offsetof(type, member)))
+
+/*
+ * Initializes an empty queue.
+ */
+void iqueue_init(iqueue* q);
+
+/*
+ * Appends a link to the end of the queue.
+ */
+void iqueue_append(iqueue* q, queue_link* link);
+
+/* Remove the first link from the queue and leaves it in link_ptr.
+ *   Returns false if the queue was empty.
+ */
+bool iqueue_remove(iqueue* q, queue_link** link_ptr);
+
+/*
+ * Removes the given link, which must be on the queue, in O(1) time.
+ */
+void iqueue_unlink(iqueue* q, queue_link* link);
+
+/*
+ * Returns true if queue is empty, false otherwise.
+ */
+bool iqueue_is_empty(iqueue* q);
+
+/*
+ * Returns number of links in the queue.
+ */
+size_t iqueue_size(iqueue* q);
+
+// Arguments can be passed to iqueue functions as raw void* pointers.
+typedef void iqueue_function_args;
+
+// Signature for a function to be applied to a link of a queue. The
+// function may unlink the link it is given, but no other link.
+typedef bool (*iqueue_function)(queue_link*, iqueue_function_args*);
+
+// Apply the iqueue_function to the links of the given queue, from first
+// to last, until it returns false. Returns isEmpty().
+bool iqueue_apply(iqueue* q, iqueue_function qf, iqueue_function_args* args);
+
+#endif  // _IQUEUE_H_
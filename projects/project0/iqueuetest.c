@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <assert.h>
+#include "iqueue.h"
+
+// An element of the queue, with the link embedded in it.
+typedef struct {
+  int value;
+  queue_link link;
+} item;
+
+// Unlink every item with an odd value.
+bool unlink_odd(queue_link* ql, iqueue_function_args* args) {
+  if (iqueue_entry(ql, item, link)->value % 2 != 0)
+    iqueue_unlink((iqueue*) args, ql);
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  item items[10];
+  iqueue q;
+  queue_link* ql;
+
+  iqueue_init(&q);
+  assert(iqueue_is_empty(&q));
+  assert(iqueue_size(&q) == 0);
+  bool removed = iqueue_remove(&q, &ql);
+  assert(!removed);
+
+  for (int i = 0; i < 10; i++) {
+    items[i].value = i;
+    iqueue_append(&q, &items[i].link);
+  }
+  assert(iqueue_size(&q) == 10);
+
+  // remove from the front, the back and the middle
+  removed = iqueue_remove(&q, &ql);
+  assert(removed);
+  assert(iqueue_entry(ql, item, link) == &items[0]);
+  iqueue_unlink(&q, &items[9].link);
+  iqueue_unlink(&q, &items[5].link);
+  assert(iqueue_size(&q) == 7);  // q: 1 2 3 4 6 7 8
+
+  iqueue_apply(&q, unlink_odd, &q);
+  assert(iqueue_size(&q) == 4);  // q: 2 4 6 8
+
+  // a removed link can be appended again
+  iqueue_append(&q, &items[0].link);  // q: 2 4 6 8 0
+
+  int expected[] = { 2, 4, 6, 8, 0 };
+  for (int i = 0; i < 5; i++) {
+    removed = iqueue_remove(&q, &ql);
+    assert(removed);
+    assert(iqueue_entry(ql, item, link)->value == expected[i]);
+  }
+  assert(iqueue_is_empty(&q));
+
+  printf("iqueuetest passed\n");
+  return 0;
+}
@@ -0,0 +1,122 @@
+/* Implements the bounded multi-producer/multi-consumer queue, after
+ * Dmitry Vyukov's bounded MPMC queue. */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mpmc_queue.h"
+
+/* Size of a cache line. Each slot, and each of the two positions that
+ * producers and consumers race on, gets a cache line of its own, so that
+ * threads working on different slots don't invalidate each other's
+ * caches. */
+#define MPMC_CACHE_LINE 64
+
+/* A slot of the ring. When seq == pos the slot is free for the producer
+ * that claims position pos; when seq == pos + 1 it holds the element
+ * for the consumer that claims pos; the consumer then sets it to
+ * pos + capacity, freeing it for the producer one lap later. */
+typedef struct _mpmc_slot {
+  size_t seq;
+  queue_element* elem;
+} __attribute__((aligned(MPMC_CACHE_LINE))) mpmc_slot;
+
+struct _mpmc_queue {
+  mpmc_slot* slots;
+  size_t mask;  // capacity - 1
+  size_t enqueue_pos __attribute__((aligned(MPMC_CACHE_LINE)));
+  size_t dequeue_pos __attribute__((aligned(MPMC_CACHE_LINE)));
+} __attribute__((aligned(MPMC_CACHE_LINE)));
+
+mpmc_queue* mpmc_queue_create(size_t capacity) {
+  // round the capacity up to a power of two so positions can be
+  // mapped to slots with a mask
+  size_t size = 2;
+  while (size < capacity)
+    size *= 2;
+
+  mpmc_queue* q;
+  if (posix_memalign((void**) &q, MPMC_CACHE_LINE, sizeof(*q)) != 0)
+    return NULL;
+  if (posix_memalign((void**) &q->slots, MPMC_CACHE_LINE,
+                     size * sizeof(*q->slots)) != 0) {
+    free(q);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < size; i++)
+    q->slots[i].seq = i;
+  q->mask = size - 1;
+  q->enqueue_pos = 0;
+  q->dequeue_pos = 0;
+
+  return q;
+}
+
+void mpmc_queue_destroy(mpmc_queue* q) {
+  if (q != NULL) {
+    free(q->slots);
+    free(q);
+  }
+}
+
+bool mpmc_queue_push(mpmc_queue* q, queue_element* elem) {
+  assert(q != NULL);
+
+  size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+  for (;;) {
+    mpmc_slot* slot = &q->slots[pos & q->mask];
+    size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+    if (diff == 0) {
+      // the slot is free: try to claim position pos
+      if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        slot->elem = elem;
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+      // another producer claimed it; pos now holds the new position
+    } else if (diff < 0) {
+      // the slot still holds the element from one lap ago: full
+      return false;
+    } else {
+      // another producer got ahead of us; catch up
+      pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+bool mpmc_queue_pop(mpmc_queue* q, queue_element** elem_ptr) {
+  assert(q != NULL);
+  assert(elem_ptr != NULL);
+
+  size_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+  for (;;) {
+    mpmc_slot* slot = &q->slots[pos & q->mask];
+    size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+    if (diff == 0) {
+      // the slot is full: try to claim position pos
+      if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        *elem_ptr = slot->elem;
+        __atomic_store_n(&slot->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    } else if (diff < 0) {
+      // the producer for this position hasn't published yet: empty
+      return false;
+    } else {
+      pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+size_t mpmc_queue_capacity(mpmc_queue* q) {
+  assert(q != NULL);
+  return q->mask + 1;
+}
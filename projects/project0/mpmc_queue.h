@@ -0,0 +1,52 @@
+#ifndef _MPMC_QUEUE_H_
+#define _MPMC_QUEUE_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "queue.h"
+
+/* Definitions for a bounded multi-producer/multi-consumer queue. Unlike
+ * queue, it is safe to use from many threads at once without any locks:
+ * every slot of its ring carries a sequence number that tells producers
+ * and consumers whether the slot is free or full, so a push or a pop
+ * costs a single compare-and-swap on the fast path. The queue only uses
+ * atomic instructions, never a lock, so it works the same from pthreads
+ * and from user-level sthreads, including when a thread is preempted
+ * half way through an operation.
+ *
+ * Push and pop never block: they return false when the queue is full or
+ * empty, and it is up to the caller to retry, yield or sleep. */
+
+// Forward declaration of the queue struct. The actual definition
+// is in mpmc_queue.c.
+typedef struct _mpmc_queue mpmc_queue;
+
+/*
+ * Creates and returns a new queue that holds at least capacity
+ * elements. The capacity is rounded up to a power of two.
+ */
+mpmc_queue* mpmc_queue_create(size_t capacity);
+
+/*
+ * Destroys the queue. No other thread may be using it.
+ */
+void mpmc_queue_destroy(mpmc_queue* q);
+
+/*
+ * Appends an element to the end of the queue. Returns false if the
+ * queue is full.
+ */
+bool mpmc_queue_push(mpmc_queue* q, queue_element* elem);
+
+/* Remove the first element from the queue and leaves result in elem_ptr.
+ *   Returns false if the queue is empty.
+ */
+bool mpmc_queue_pop(mpmc_queue* q, queue_element** elem_ptr);
+
+/*
+ * Returns the number of elements the queue can hold.
+ */
+size_t mpmc_queue_capacity(mpmc_queue* q);
+
+#endif  // _MPMC_QUEUE_H_
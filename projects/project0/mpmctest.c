@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include "mpmc_queue.h"
+
+#define NUM_PRODUCERS 4
+#define NUM_CONSUMERS 4
+#define ITEMS_PER_PRODUCER 200000
+
+static mpmc_queue* q;
+static uint64_t consumed_sum[NUM_CONSUMERS];
+static size_t consumed_count[NUM_CONSUMERS];
+static size_t total_consumed;
+
+// Pushes the values 1..ITEMS_PER_PRODUCER, retrying while the queue is full.
+void* producer(void* arg) {
+  for (uintptr_t i = 1; i <= ITEMS_PER_PRODUCER; i++) {
+    while (!mpmc_queue_push(q, (queue_element*) i))
+      sched_yield();
+  }
+  return NULL;
+}
+
+// Pops values until every produced value has been consumed.
+void* consumer(void* arg) {
+  int id = (int) (intptr_t) arg;
+  const size_t total = (size_t) NUM_PRODUCERS * ITEMS_PER_PRODUCER;
+
+  while (__atomic_load_n(&total_consumed, __ATOMIC_RELAXED) < total) {
+    queue_element* elem;
+    if (mpmc_queue_pop(q, &elem)) {
+      consumed_sum[id] += (uintptr_t) elem;
+      consumed_count[id]++;
+      __atomic_add_fetch(&total_consumed, 1, __ATOMIC_RELAXED);
+    } else {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char* argv[]) {
+  queue_element* elem;
+  int x = 0;
+  int y = 1;
+
+  q = mpmc_queue_create(3);
+  assert(q != NULL);
+  assert(mpmc_queue_capacity(q) == 4);
+  bool ok = mpmc_queue_pop(q, &elem);
+  assert(!ok);
+
+  // fill it up, then check FIFO order on a single thread
+  for (int i = 0; i < 4; i++) {
+    ok = mpmc_queue_push(q, i % 2 == 0 ? &x : &y);
+    assert(ok);
+  }
+  ok = mpmc_queue_push(q, &x);
+  assert(!ok);
+  for (int i = 0; i < 4; i++) {
+    ok = mpmc_queue_pop(q, &elem);
+    assert(ok);
+    assert(elem == (i % 2 == 0 ? &x : &y));
+  }
+  ok = mpmc_queue_pop(q, &elem);
+  assert(!ok);
+  mpmc_queue_destroy(q);
+
+  // hammer a small queue from several producers and consumers
+  q = mpmc_queue_create(64);
+  assert(q != NULL);
+
+  pthread_t producers[NUM_PRODUCERS];
+  pthread_t consumers[NUM_CONSUMERS];
+  for (intptr_t i = 0; i < NUM_CONSUMERS; i++) {
+    if (pthread_create(&consumers[i], NULL, consumer, (void*) i) != 0) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+  for (int i = 0; i < NUM_PRODUCERS; i++) {
+    if (pthread_create(&producers[i], NULL, producer, NULL) != 0) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+  for (int i = 0; i < NUM_PRODUCERS; i++)
+    pthread_join(producers[i], NULL);
+  for (int i = 0; i < NUM_CONSUMERS; i++)
+    pthread_join(consumers[i], NULL);
+
+  uint64_t sum = 0;
+  size_t count = 0;
+  for (int i = 0; i < NUM_CONSUMERS; i++) {
+    sum += consumed_sum[i];
+    count += consumed_count[i];
+  }
+  assert(count == (size_t) NUM_PRODUCERS * ITEMS_PER_PRODUCER);
+  assert(sum == (uint64_t) NUM_PRODUCERS *
+         ITEMS_PER_PRODUCER * (ITEMS_PER_PRODUCER + 1) / 2);
+  ok = mpmc_queue_pop(q, &elem);
+  assert(!ok);
+  mpmc_queue_destroy(q);
+
+  printf("mpmctest passed\n");
+  return 0;
+}
@@ -0,0 +1,233 @@
+/* Implements the priority queue as an array-backed 4-ary heap. */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "pqueue.h"
+
+/* Number of children of each heap node. A wider heap is shallower than a
+ * binary heap, so sifting an element up touches fewer cache lines, and
+ * the children of a node sit next to each other in memory. */
+#define PQUEUE_ARITY 4
+
+/* Capacity that an empty priority queue starts with. */
+#define PQUEUE_INITIAL_CAPACITY 16
+
+/* Marks the end of the list of free handles. */
+#define PQUEUE_NO_HANDLE ((pqueue_handle) -1)
+
+/* The heap stores handles rather than elements, and pos[] maps each
+ * handle back to its position in the heap, so that decrease_key can find
+ * an element without searching. Handles that are not in use are chained
+ * together through pos[] into a free list. */
+struct _pqueue {
+  queue_compare qc;
+  size_t size;                // number of elements in the heap
+  size_t capacity;            // length of each of the arrays below
+  pqueue_handle* heap;        // handle of the element at each position
+  size_t* pos;                // heap position of each handle in use
+  queue_element** elems;      // element of each handle in use
+  pqueue_handle free_list;    // first free handle that has been used before
+  pqueue_handle next_handle;  // handles from here up have never been used
+};
+
+static pqueue* pqueue_alloc(queue_compare qc, size_t capacity) {
+  pqueue* pq = (pqueue*) malloc(sizeof(pqueue));
+  if (pq == NULL)
+    return NULL;
+
+  pq->qc = qc;
+  pq->size = 0;
+  pq->capacity = capacity;
+  pq->heap = (pqueue_handle*) malloc(capacity * sizeof(pqueue_handle));
+  pq->pos = (size_t*) malloc(capacity * sizeof(size_t));
+  pq->elems = (queue_element**) malloc(capacity * sizeof(queue_element*));
+  pq->free_list = PQUEUE_NO_HANDLE;
+  pq->next_handle = 0;
+
+  // free up everything if any of the arrays couldn't be allocated
+  if (pq->heap == NULL || pq->pos == NULL || pq->elems == NULL) {
+    pqueue_destroy(pq);
+    return NULL;
+  }
+
+  return pq;
+}
+
+pqueue* pqueue_create(queue_compare qc) {
+  assert(qc != NULL);
+  return pqueue_alloc(qc, PQUEUE_INITIAL_CAPACITY);
+}
+
+/* Private: moves the element at heap position i towards the root
+ * until its parent is not greater than it. */
+static void pqueue_sift_up(pqueue* pq, size_t i) {
+  pqueue_handle h = pq->heap[i];
+
+  while (i > 0) {
+    size_t parent = (i - 1) / PQUEUE_ARITY;
+    if (pq->qc(pq->elems[h], pq->elems[pq->heap[parent]]) >= 0)
+      break;
+
+    pq->heap[i] = pq->heap[parent];
+    pq->pos[pq->heap[i]] = i;
+    i = parent;
+  }
+
+  pq->heap[i] = h;
+  pq->pos[h] = i;
+}
+
+/* Private: moves the element at heap position i towards the leaves
+ * until none of its children is smaller than it. */
+static void pqueue_sift_down(pqueue* pq, size_t i) {
+  pqueue_handle h = pq->heap[i];
+
+  while (PQUEUE_ARITY * i + 1 < pq->size) {
+    // find the smallest child
+    size_t first = PQUEUE_ARITY * i + 1;
+    size_t last = first + PQUEUE_ARITY < pq->size ?
+                  first + PQUEUE_ARITY : pq->size;
+    size_t child = first;
+    for (size_t c = first + 1; c < last; c++) {
+      if (pq->qc(pq->elems[pq->heap[c]], pq->elems[pq->heap[child]]) < 0)
+        child = c;
+    }
+
+    if (pq->qc(pq->elems[pq->heap[child]], pq->elems[h]) >= 0)
+      break;
+
+    pq->heap[i] = pq->heap[child];
+    pq->pos[pq->heap[i]] = i;
+    i = child;
+  }
+
+  pq->heap[i] = h;
+  pq->pos[h] = i;
+}
+
+pqueue* pqueue_heapify(queue_compare qc, queue_element** elems, size_t n) {
+  assert(qc != NULL);
+  assert(elems != NULL || n == 0);
+
+  pqueue* pq = pqueue_alloc(qc, n > PQUEUE_INITIAL_CAPACITY ?
+                                n : PQUEUE_INITIAL_CAPACITY);
+  if (pq == NULL)
+    return NULL;
+
+  for (size_t i = 0; i < n; i++) {
+    pq->elems[i] = elems[i];
+    pq->heap[i] = i;
+    pq->pos[i] = i;
+  }
+  pq->size = n;
+  pq->next_handle = n;
+
+  // sift down every node that has children, from the last one up
+  if (n > 1) {
+    for (size_t i = (n - 2) / PQUEUE_ARITY + 1; i-- > 0; )
+      pqueue_sift_down(pq, i);
+  }
+
+  return pq;
+}
+
+void pqueue_destroy(pqueue* pq) {
+  if (pq != NULL) {
+    free(pq->heap);
+    free(pq->pos);
+    free(pq->elems);
+    free(pq);
+  }
+}
+
+/* Private: doubles the capacity of the arrays. */
+static void pqueue_grow(pqueue* pq) {
+  size_t capacity = 2 * pq->capacity;
+
+  pq->heap = (pqueue_handle*) realloc(pq->heap,
+                                      capacity * sizeof(pqueue_handle));
+  pq->pos = (size_t*) realloc(pq->pos, capacity * sizeof(size_t));
+  pq->elems = (queue_element**) realloc(pq->elems,
+                                        capacity * sizeof(*pq->elems));
+  assert(pq->heap != NULL && pq->pos != NULL && pq->elems != NULL);
+
+  pq->capacity = capacity;
+}
+
+pqueue_handle pqueue_push(pqueue* pq, queue_element* elem) {
+  assert(pq != NULL);
+
+  // take a handle off the free list, or a never used one
+  pqueue_handle h = pq->free_list;
+  if (h != PQUEUE_NO_HANDLE) {
+    pq->free_list = pq->pos[h];
+  } else {
+    if (pq->next_handle == pq->capacity)
+      pqueue_grow(pq);
+    h = pq->next_handle++;
+  }
+
+  pq->elems[h] = elem;
+  pq->heap[pq->size] = h;
+  pq->pos[h] = pq->size;
+  pq->size++;
+  pqueue_sift_up(pq, pq->size - 1);
+
+  return h;
+}
+
+bool pqueue_pop_min(pqueue* pq, queue_element** elem_ptr) {
+  assert(pq != NULL);
+  assert(elem_ptr != NULL);
+  if (pqueue_is_empty(pq)) {
+    return false;
+  }
+
+  pqueue_handle h = pq->heap[0];
+  *elem_ptr = pq->elems[h];
+
+  // move the last element to the root and let it sink
+  pq->size--;
+  if (pq->size > 0) {
+    pq->heap[0] = pq->heap[pq->size];
+    pqueue_sift_down(pq, 0);
+  }
+
+  // return the handle to the free list
+  pq->pos[h] = pq->free_list;
+  pq->free_list = h;
+
+  return true;
+}
+
+bool pqueue_peek(pqueue* pq, queue_element** elem_ptr) {
+  assert(pq != NULL);
+  assert(elem_ptr != NULL);
+  if (pqueue_is_empty(pq)) {
+    return false;
+  }
+
+  *elem_ptr = pq->elems[pq->heap[0]];
+  return true;
+}
+
+void pqueue_decrease_key(pqueue* pq, pqueue_handle h, queue_element* elem) {
+  assert(pq != NULL);
+  assert(h < pq->next_handle && pq->pos[h] < pq->size &&
+         pq->heap[pq->pos[h]] == h);
+  assert(pq->qc(elem, pq->elems[h]) <= 0 || elem == pq->elems[h]);
+
+  pq->elems[h] = elem;
+  pqueue_sift_up(pq, pq->pos[h]);
+}
+
+bool pqueue_is_empty(pqueue* pq) {
+  assert(pq != NULL);
+  return pq->size == 0;
+}
+
+size_t pqueue_size(pqueue* pq) {
+  assert(pq != NULL);
+  return pq->size;
+}
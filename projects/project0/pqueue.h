@@ -0,0 +1,73 @@
+#ifndef _PQUEUE_H_
+#define _PQUEUE_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "queue.h"
+
+/* Definitions for a priority queue. Elements are ordered by the same
+ * queue_compare functions that queue_sort uses, and the element that
+ * compares smallest is always at the front. The implementation is an
+ * array-backed 4-ary heap: push, pop_min and decrease_key are
+ * O(log n), peek is O(1), and none of them allocates memory except
+ * when the arrays have to grow. */
+
+// Forward declaration of the priority queue struct. The actual
+// definition is in pqueue.c.
+typedef struct _pqueue pqueue;
+
+// Handle identifying an element for as long as it is in the priority
+// queue. A handle may be reused for a new element once its element
+// has been popped.
+typedef size_t pqueue_handle;
+
+/*
+ * Creates and returns a new, empty priority queue ordered by qc.
+ */
+pqueue* pqueue_create(queue_compare qc);
+
+/*
+ * Creates and returns a new priority queue ordered by qc holding the n
+ * elements of the given array, in O(n) time. The handle of elems[i] is i.
+ */
+pqueue* pqueue_heapify(queue_compare qc, queue_element** elems, size_t n);
+
+/*
+ * Destroys the priority queue. The elements themselves are not freed.
+ */
+void pqueue_destroy(pqueue* pq);
+
+/*
+ * Adds an element to the priority queue and returns its handle.
+ */
+pqueue_handle pqueue_push(pqueue* pq, queue_element* elem);
+
+/* Removes the smallest element from the priority queue and leaves it in
+ *   elem_ptr. Returns false if the priority queue was empty.
+ */
+bool pqueue_pop_min(pqueue* pq, queue_element** elem_ptr);
+
+/* Leaves the smallest element in elem_ptr without removing it.
+ *   Returns false if the priority queue is empty.
+ */
+bool pqueue_peek(pqueue* pq, queue_element** elem_ptr);
+
+/*
+ * Replaces the element with the given handle by elem, which must not
+ * compare greater than the element it replaces. elem may be the same
+ * pointer, if the caller has lowered the element's key in place.
+ */
+void pqueue_decrease_key(pqueue* pq, pqueue_handle h, queue_element* elem);
+
+/*
+ * Returns true if the priority queue is empty, false otherwise.
+ */
+bool pqueue_is_empty(pqueue* pq);
+
+/*
+ * Returns number of elements in the priority queue.
+ */
+size_t pqueue_size(pqueue* pq);
+
+#endif  // _PQUEUE_H_
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include "pqueue.h"
+
+int compare_elem(queue_element* e1, queue_element* e2) {
+  int i1 = *(int*) e1;
+  int i2 = *(int*) e2;
+
+  if (i1 < i2)
+    return -1;
+  if (i1 > i2)
+    return 1;
+  return 0;
+}
+
+// Pops every element off the priority queue, checking that they come
+// out in non-decreasing order, and returns how many there were.
+size_t drain_in_order(pqueue* pq) {
+  size_t count = 0;
+  int* prev = NULL;
+  queue_element* elem;
+
+  while (pqueue_pop_min(pq, &elem)) {
+    if (prev != NULL)
+      assert(*prev <= *(int*) elem);
+    prev = (int*) elem;
+    count++;
+  }
+
+  assert(pqueue_is_empty(pq));
+  return count;
+}
+
+int main(int argc, char* argv[]) {
+  const int n = 10000;
+  unsigned int seed = 451;
+  int* values = (int*) malloc(n * sizeof(*values));
+  pqueue_handle* handles = (pqueue_handle*) malloc(n * sizeof(pqueue_handle));
+  assert(values != NULL && handles != NULL);
+
+  pqueue* pq = pqueue_create(&compare_elem);
+  assert(pq != NULL);
+  assert(pqueue_is_empty(pq));
+  assert(pqueue_size(pq) == 0);
+
+  queue_element* elem;
+  assert(!pqueue_peek(pq, &elem));
+  bool popped = pqueue_pop_min(pq, &elem);
+  assert(!popped);
+
+  int x = 2;
+  int y = 0;
+  int z = 1;
+  pqueue_push(pq, &x);
+  pqueue_push(pq, &y);
+  pqueue_push(pq, &z);
+  assert(pqueue_size(pq) == 3);
+  assert(pqueue_peek(pq, &elem) && elem == &y);
+  popped = pqueue_pop_min(pq, &elem);
+  assert(popped && elem == &y);
+  popped = pqueue_pop_min(pq, &elem);
+  assert(popped && elem == &z);
+  popped = pqueue_pop_min(pq, &elem);
+  assert(popped && elem == &x);
+  assert(pqueue_is_empty(pq));
+
+  // push many random values, lowering some of their keys on the way
+  for (int i = 0; i < n; i++) {
+    values[i] = rand_r(&seed) % 100000;
+    handles[i] = pqueue_push(pq, &values[i]);
+  }
+  for (int i = 0; i < n; i += 7) {
+    values[i] -= rand_r(&seed) % 1000;
+    pqueue_decrease_key(pq, handles[i], &values[i]);
+  }
+  assert(pqueue_size(pq) == n);
+  assert(drain_in_order(pq) == n);
+  pqueue_destroy(pq);
+
+  // build a priority queue from an array in one go
+  queue_element** elems = (queue_element**) malloc(n * sizeof(*elems));
+  assert(elems != NULL);
+  for (int i = 0; i < n; i++) {
+    values[i] = rand_r(&seed) % 100000;
+    elems[i] = &values[i];
+  }
+  pq = pqueue_heapify(&compare_elem, elems, n);
+  assert(pq != NULL);
+  assert(pqueue_size(pq) == n);
+  values[n - 1] = -1;
+  pqueue_decrease_key(pq, n - 1, &values[n - 1]);
+  assert(pqueue_peek(pq, &elem) && elem == &values[n - 1]);
+  assert(drain_in_order(pq) == n);
+  pqueue_destroy(pq);
+
+  printf("pqueuetest passed\n");
+
+  free(elems);
+  free(handles);
+  free(values);
+  return 0;
+}
@@ -1,88 +1,205 @@
 /* Implements queue abstract data type. */
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "queue.h"
 
-/* Each link in the queue stores a queue_element and
- * a pointer to the next link in the queue. */
-typedef struct _queue_link {
-  queue_element* elem;
-  struct _queue_link* next;
-} queue_link;
+/* Number of element slots in each chunk of the queue. */
+#define QUEUE_CHUNK_SLOTS 64
+
+/* The queue stores its elements in a singly linked list of fixed-size
+ * chunks rather than in one heap node per element. Each chunk holds a
+ * contiguous run of elements in slots[begin..end). Elements are appended
+ * at the end of the tail chunk and removed from the beginning of the
+ * head chunk, so appends and removes only touch the heap once every
+ * QUEUE_CHUNK_SLOTS elements. */
+typedef struct _queue_chunk {
+  struct _queue_chunk* next;
+  size_t begin;
+  size_t end;
+  queue_element* slots[QUEUE_CHUNK_SLOTS];
+} queue_chunk;
 
 /* This is the actual implementation of the queue struct that
  * is declared in queue.h. */
 struct _queue {
-  queue_link* head;
+  queue_chunk* head;
+  queue_chunk* tail;
+  // an emptied chunk kept around so that a queue cycling through
+  // its chunks in steady state never calls malloc/free
+  queue_chunk* spare;
+  size_t size;
 };
 
 queue* queue_create() {
   queue* q = (queue*) malloc(sizeof(queue));
 
   // check if malloc succeeded
-  if (q != NULL)
+  if (q != NULL) {
     q->head = NULL;
+    q->tail = NULL;
+    q->spare = NULL;
+    q->size = 0;
+  }
 
   return q;
 }
 
 /* Private */
-static queue_link* queue_new_element(queue_element* elem) {
-  queue_link* ql = (queue_link*) malloc(sizeof(queue_link));
+static queue_chunk* queue_new_chunk(queue* q) {
+  queue_chunk* qc = q->spare;
+
+  // reuse the spare chunk if there is one
+  if (qc != NULL)
+    q->spare = NULL;
+  else
+    qc = (queue_chunk*) malloc(sizeof(queue_chunk));
 
   // check if malloc succeeded
-  if (ql != NULL) {
-    ql->elem = elem;
-    ql->next = NULL;
+  if (qc != NULL) {
+    qc->next = NULL;
+    qc->begin = 0;
+    qc->end = 0;
   }
 
-  return ql;
+  return qc;
+}
+
+/* Private */
+static void queue_release_chunk(queue* q, queue_chunk* qc) {
+  // keep one chunk for the next queue_new_chunk, free the rest
+  if (q->spare == NULL)
+    q->spare = qc;
+  else
+    free(qc);
+}
+
+/* Private: makes sure the tail chunk has at least one free slot. */
+static void queue_reserve_tail(queue* q) {
+  // Start a new chunk if the queue is empty or the tail chunk is full.
+  if (q->tail == NULL || q->tail->end == QUEUE_CHUNK_SLOTS) {
+    queue_chunk* new_chunk = queue_new_chunk(q);
+    assert(new_chunk != NULL);
+
+    if (q->tail == NULL)
+      q->head = new_chunk;
+    else
+      q->tail->next = new_chunk;
+    q->tail = new_chunk;
+  }
+}
+
+/* Private: recycles the head chunk once all of its elements
+ * have been removed. */
+static void queue_trim_head(queue* q) {
+  queue_chunk* old_head = q->head;
+
+  if (old_head->begin == old_head->end) {
+    if (old_head == q->tail) {
+      // the only chunk: rewind it in place instead of freeing it
+      old_head->begin = 0;
+      old_head->end = 0;
+    } else {
+      q->head = old_head->next;
+      queue_release_chunk(q, old_head);
+    }
+  }
 }
 
 void queue_append(queue* q, queue_element* elem) {
   assert(q != NULL);
 
-  queue_link* new_elem = queue_new_element(elem);
-  assert(new_elem != NULL);
+  queue_reserve_tail(q);
+  q->tail->slots[q->tail->end++] = elem;
+  q->size++;
+}
 
-  // Set element to be head of queue if queue is empty.
-  if (q->head == NULL) {
-    q->head = new_elem;
-    return;
+void queue_append_n(queue* q, queue_element** elems, size_t n) {
+  assert(q != NULL);
+  assert(elems != NULL || n == 0);
+
+  // fill the tail chunk a run of slots at a time
+  size_t done = 0;
+  while (done < n) {
+    queue_reserve_tail(q);
+
+    size_t count = QUEUE_CHUNK_SLOTS - q->tail->end;
+    if (count > n - done)
+      count = n - done;
+    memcpy(&q->tail->slots[q->tail->end], &elems[done],
+           count * sizeof(*elems));
+    q->tail->end += count;
+    done += count;
   }
 
-  // Find the last link in the queue.
-  queue_link* cur;
-  for (cur = q->head; cur->next; cur = cur->next) {}
-
-  // Append the new link.
-  cur->next = new_elem;
+  q->size += n;
 }
 
 bool queue_remove(queue* q, queue_element** elem_ptr) {
-  queue_link* old_head;
-
   assert(q != NULL);
   assert(elem_ptr != NULL);
   if (queue_is_empty(q)) {
     return false;
   }
 
-  *elem_ptr = q->head->elem;
-  old_head = q->head;
-  q->head = q->head->next;
-
-  // free the _queue_link struct after removing the element
-  free(old_head);
+  *elem_ptr = q->head->slots[q->head->begin++];
+  q->size--;
+  queue_trim_head(q);
 
   return true;
 }
 
+size_t queue_drain(queue* q, queue_element** out, size_t max) {
+  assert(q != NULL);
+  assert(out != NULL || max == 0);
+
+  // copy out the head chunk a run of slots at a time
+  size_t done = 0;
+  while (done < max && !queue_is_empty(q)) {
+    size_t count = q->head->end - q->head->begin;
+    if (count > max - done)
+      count = max - done;
+    memcpy(&out[done], &q->head->slots[q->head->begin],
+           count * sizeof(*out));
+    q->head->begin += count;
+    q->size -= count;
+    done += count;
+    queue_trim_head(q);
+  }
+
+  return done;
+}
+
+void queue_concat(queue* q, queue* other) {
+  assert(q != NULL && other != NULL && q != other);
+
+  if (queue_is_empty(other))
+    return;
+
+  if (queue_is_empty(q)) {
+    // drop the rewound chunk an empty queue may still hold
+    if (q->head != NULL)
+      queue_release_chunk(q, q->head);
+    q->head = other->head;
+  } else {
+    // q's tail chunk may be left partially filled in the middle of
+    // the list; appends only ever write to the last chunk
+    q->tail->next = other->head;
+  }
+  q->tail = other->tail;
+  q->size += other->size;
+
+  other->head = NULL;
+  other->tail = NULL;
+  other->size = 0;
+}
+
 void queue_destroy(queue* q) {
-  queue_link* cur;
-  queue_link* next;
+  queue_chunk* cur;
+  queue_chunk* next;
   if (q != NULL) {
     cur = q->head;
     while (cur) {
@@ -90,26 +207,19 @@ void queue_destroy(queue* q) {
       free(cur);
       cur = next;
     }
+    free(q->spare);
     free(q);
   }
 }
 
 bool queue_is_empty(queue* q) {
   assert(q != NULL);
-  return q->head == NULL;
-}
-
-/* private */
-static bool queue_count_one(queue_element* elem, queue_function_args* args) {
-  size_t* count = (size_t*) args;
-  *count = *count + 1;
-  return true;
+  return q->size == 0;
 }
 
 size_t queue_size(queue* q) {
-  size_t count = 0;
-  queue_apply(q, queue_count_one, &count);
-  return count;
+  assert(q != NULL);
+  return q->size;
 }
 
 bool queue_apply(queue* q, queue_function qf, queue_function_args* args) {
@@ -118,75 +228,258 @@ bool queue_apply(queue* q, queue_function qf, queue_function_args* args) {
   if (queue_is_empty(q))
     return false;
 
-  for (queue_link* cur = q->head; cur; cur = cur->next) {
-    if (!qf(cur->elem, args))
-      break;
+  for (queue_chunk* cur = q->head; cur; cur = cur->next) {
+    for (size_t i = cur->begin; i < cur->end; i++) {
+      if (!qf(cur->slots[i], args))
+        return true;
+    }
   }
 
   return true;
 }
 
+void queue_reverse(queue* q) {
+  assert(q != NULL);
+
+  // no need to modify the queue is its size is less than 2
+  if (queue_size(q) < 2)
+    return;
+
+  // reverse the order of the chunks by flipping their next
+  // pointers, and reverse the run of elements inside each chunk
+  queue_chunk* prev = NULL;
+  queue_chunk* cur = q->head;
+  while (cur != NULL) {
+    for (size_t i = cur->begin, j = cur->end; i + 1 < j; i++, j--) {
+      queue_element* temp = cur->slots[i];
+      cur->slots[i] = cur->slots[j - 1];
+      cur->slots[j - 1] = temp;
+    }
+
+    queue_chunk* next = cur->next;
+    cur->next = prev;
+    prev = cur;
+    cur = next;
+  }
+
+  q->tail = q->head;
+  q->head = prev;
+}
+
+/* Runs shorter than this are sorted by insertion sort before merging. */
+#define QUEUE_SORT_RUN 16
+
 /*
- * Helper method for queue_reverse.
+ * Helper method for queue_sort. Merges the sorted runs src[lo..mid)
+ * and src[mid..hi) into dst[lo..hi). Ties are taken from the left run
+ * so that the merge is stable.
  */
-static void queue_find_idx(queue_link* qls, size_t cur_idx,
-                           size_t target_idx, queue_link** qlt) {
-  for (*qlt = qls; cur_idx < target_idx; *qlt = (*qlt)->next)
-    cur_idx++;
+static void queue_merge(queue_element** src, queue_element** dst,
+                        size_t lo, size_t mid, size_t hi, queue_compare qc) {
+  size_t i = lo;
+  size_t j = mid;
+  size_t k = lo;
+
+  while (i < mid && j < hi) {
+    if (qc(src[j], src[i]) < 0)
+      dst[k++] = src[j++];
+    else
+      dst[k++] = src[i++];
+  }
+  while (i < mid)
+    dst[k++] = src[i++];
+  while (j < hi)
+    dst[k++] = src[j++];
 }
 
-void queue_reverse(queue* q) {
-  assert(q != NULL);
+/* Sorts the elements with a stable bottom-up merge sort. */
+void queue_sort(queue* q, queue_compare qc) {
+  assert(q != NULL && qc != NULL);
 
   size_t qs = queue_size(q);
-
-  // no need to modify the queue is its size is less than 2
+  // no need to sort if size of queue if less than 2
   if (qs < 2)
     return;
 
-  // see the queue as two halves and swap the element
-  // of the queue link (i) in the first half with the
-  // element of the corresponding queue link (qs-i-1)
-  queue_link* cur = q->head;
-  queue_link* target;
-  for (size_t i = 0; i < qs / 2; i++) {
-    queue_find_idx(cur, i, qs - i - 1, &target);
-    queue_element* temp;
-    temp = cur->elem;
-    cur->elem = target->elem;
-    target->elem = temp;
-    cur = cur->next;
+  // copy the elements out of the chunks into one array, with
+  // room for a second array that the merge passes alternate with
+  queue_element** buf =
+      (queue_element**) malloc(2 * qs * sizeof(queue_element*));
+  assert(buf != NULL);
+  queue_element** src = buf;
+  queue_element** dst = buf + qs;
+
+  size_t n = 0;
+  for (queue_chunk* cur = q->head; cur; cur = cur->next) {
+    for (size_t i = cur->begin; i < cur->end; i++)
+      src[n++] = cur->slots[i];
   }
+
+  // insertion sort short runs, which is stable and cheap for small n
+  for (size_t lo = 0; lo < qs; lo += QUEUE_SORT_RUN) {
+    size_t hi = lo + QUEUE_SORT_RUN < qs ? lo + QUEUE_SORT_RUN : qs;
+    for (size_t i = lo + 1; i < hi; i++) {
+      queue_element* elem = src[i];
+      size_t j = i;
+      while (j > lo && qc(src[j - 1], elem) > 0) {
+        src[j] = src[j - 1];
+        j--;
+      }
+      src[j] = elem;
+    }
+  }
+
+  // merge pairs of runs of doubling width until one run is left
+  for (size_t width = QUEUE_SORT_RUN; width < qs; width *= 2) {
+    for (size_t lo = 0; lo < qs; lo += 2 * width) {
+      size_t mid = lo + width < qs ? lo + width : qs;
+      size_t hi = lo + 2 * width < qs ? lo + 2 * width : qs;
+      queue_merge(src, dst, lo, mid, hi, qc);
+    }
+    queue_element** temp = src;
+    src = dst;
+    dst = temp;
+  }
+
+  // copy the sorted elements back into the chunks
+  n = 0;
+  for (queue_chunk* cur = q->head; cur; cur = cur->next) {
+    for (size_t i = cur->begin; i < cur->end; i++)
+      cur->slots[i] = src[n++];
+  }
+
+  free(buf);
 }
 
-/* Sorting part I refer to CSE 333 Project 1. */
-void queue_sort(queue* q, queue_compare qc) {
-  assert(q != NULL);
+/* Queues smaller than this are sorted by merge sort on the keys rather
+ * than by radix sort, whose histogram passes don't pay off for them. */
+#define QUEUE_RADIX_MIN 256
+
+/* Number of bits of the key handled by each radix pass. */
+#define QUEUE_RADIX_BITS 8
+#define QUEUE_RADIX_BUCKETS (1 << QUEUE_RADIX_BITS)
+#define QUEUE_RADIX_PASSES (64 / QUEUE_RADIX_BITS)
+
+/* An element together with its key, so that the key function is called
+ * only once per element. */
+typedef struct _queue_keyed {
+  uint64_t key;
+  queue_element* elem;
+} queue_keyed;
+
+/*
+ * Helper method for queue_sort_by_key: stable bottom-up merge sort of
+ * src[0..n) by key. Returns whichever of src and dst holds the result.
+ */
+static queue_keyed* queue_merge_sort_keyed(queue_keyed* src, queue_keyed* dst,
+                                           size_t n) {
+  for (size_t width = 1; width < n; width *= 2) {
+    for (size_t lo = 0; lo < n; lo += 2 * width) {
+      size_t mid = lo + width < n ? lo + width : n;
+      size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+      size_t i = lo;
+      size_t j = mid;
+
+      for (size_t k = lo; k < hi; k++) {
+        if (i < mid && (j >= hi || src[i].key <= src[j].key))
+          dst[k] = src[i++];
+        else
+          dst[k] = src[j++];
+      }
+    }
+    queue_keyed* temp = src;
+    src = dst;
+    dst = temp;
+  }
+
+  return src;
+}
+
+/*
+ * Helper method for queue_sort_by_key: LSD radix sort of src[0..n) by
+ * key, one byte per pass. Returns whichever of src and dst holds the
+ * result.
+ */
+static queue_keyed* queue_radix_sort_keyed(queue_keyed* src, queue_keyed* dst,
+                                           size_t n) {
+  // count the digits of every pass in a single read of the keys
+  size_t (*counts)[QUEUE_RADIX_BUCKETS] = (size_t (*)[QUEUE_RADIX_BUCKETS])
+      calloc(QUEUE_RADIX_PASSES, sizeof(*counts));
+  assert(counts != NULL);
+
+  for (size_t i = 0; i < n; i++) {
+    for (int pass = 0; pass < QUEUE_RADIX_PASSES; pass++) {
+      size_t digit = (src[i].key >> (pass * QUEUE_RADIX_BITS)) &
+                     (QUEUE_RADIX_BUCKETS - 1);
+      counts[pass][digit]++;
+    }
+  }
+
+  for (int pass = 0; pass < QUEUE_RADIX_PASSES; pass++) {
+    int shift = pass * QUEUE_RADIX_BITS;
+
+    // skip passes in which every key has the same digit, such as the
+    // high bytes of small ids or timestamps
+    size_t first_digit = (src[0].key >> shift) & (QUEUE_RADIX_BUCKETS - 1);
+    if (counts[pass][first_digit] == n)
+      continue;
+
+    // turn the counts into the offset of each bucket
+    size_t offset = 0;
+    for (int digit = 0; digit < QUEUE_RADIX_BUCKETS; digit++) {
+      size_t count = counts[pass][digit];
+      counts[pass][digit] = offset;
+      offset += count;
+    }
+
+    // scatter in order, which keeps each pass stable
+    for (size_t i = 0; i < n; i++) {
+      size_t digit = (src[i].key >> shift) & (QUEUE_RADIX_BUCKETS - 1);
+      dst[counts[pass][digit]++] = src[i];
+    }
+
+    queue_keyed* temp = src;
+    src = dst;
+    dst = temp;
+  }
+
+  free(counts);
+  return src;
+}
+
+void queue_sort_by_key(queue* q, queue_key_function key_fn) {
+  assert(q != NULL && key_fn != NULL);
 
   size_t qs = queue_size(q);
   // no need to sort if size of queue if less than 2
   if (qs < 2)
     return;
 
-  // sort the queue using bubble sort
-  // boolean flag to indicate whether sorting is done
-  bool swapped;
-  do {
-    queue_link* cur = q->head;
-    swapped = false;
-
-    while (cur->next != NULL) {
-      int res = qc(cur->elem, cur->next->elem);
-
-      // swap elements of two queue links if res > 0
-      if (res > 0) {
-        queue_element* temp;
-        temp = cur->elem;
-        cur->elem = cur->next->elem;
-        cur->next->elem = temp;
-        swapped = true;
-      }
-      cur = cur->next;
+  queue_keyed* buf = (queue_keyed*) malloc(2 * qs * sizeof(queue_keyed));
+  assert(buf != NULL);
+
+  // extract every key once
+  size_t n = 0;
+  for (queue_chunk* cur = q->head; cur; cur = cur->next) {
+    for (size_t i = cur->begin; i < cur->end; i++) {
+      buf[n].key = key_fn(cur->slots[i]);
+      buf[n].elem = cur->slots[i];
+      n++;
     }
-  } while (swapped);
+  }
+
+  queue_keyed* sorted;
+  if (qs < QUEUE_RADIX_MIN)
+    sorted = queue_merge_sort_keyed(buf, buf + qs, qs);
+  else
+    sorted = queue_radix_sort_keyed(buf, buf + qs, qs);
+
+  // copy the sorted elements back into the chunks
+  n = 0;
+  for (queue_chunk* cur = q->head; cur; cur = cur->next) {
+    for (size_t i = cur->begin; i < cur->end; i++)
+      cur->slots[i] = sorted[n++].elem;
+  }
+
+  free(buf);
 }
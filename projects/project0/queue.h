@@ -2,6 +2,7 @@
 #define _QUEUE_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 // Forward declaration of the queue struct. The actual definition
@@ -27,6 +28,24 @@ void queue_append(queue* q, queue_element* elem);
  */
 bool queue_remove(queue* q, queue_element** elem_ptr);
 
+/*
+ * Appends the n elements of the given array to the end of the queue,
+ * in array order.
+ */
+void queue_append_n(queue* q, queue_element** elems, size_t n);
+
+/* Removes up to max elements from the front of the queue into out, in
+ *   queue order. Returns the number of elements removed, which is less
+ *   than max only if the queue ran empty.
+ */
+size_t queue_drain(queue* q, queue_element** out, size_t max);
+
+/*
+ * Moves all the elements of other to the end of q in O(1) time, leaving
+ * other empty. other must still be destroyed with queue_destroy.
+ */
+void queue_concat(queue* q, queue* other);
+
 /*
  * Destroys the queue.
  */
@@ -87,10 +106,8 @@ typedef bool (*queue_function)(queue_element*, queue_function_args*);
 bool queue_apply(queue* q, queue_function qf,
                  queue_function_args* args);
 
-/* THESE FUNCTIONS ARE NOT IMPLEMENTED */
-
 /*
- * Reverses the elements on the queue in place.
+ * Reverses the elements on the queue in place, in O(n) time.
  */
 void queue_reverse(queue* q);
 
@@ -98,8 +115,20 @@ void queue_reverse(queue* q);
 // should return -1 if e1 < e2, 0 if e1 == e2, and 1 if e1 > e2.
 typedef int (*queue_compare)(queue_element* /* e1* */, queue_element* /* e2* */);  // NOLINT
 
-// Sorts the elements of the given queue in place.
+// Sorts the elements of the given queue in place, in O(n log n) time.
+// The sort is stable: elements that compare equal keep their relative
+// order.
 void queue_sort(queue* q, queue_compare qc);
 
+// Extract an unsigned 64-bit sort key, such as a timestamp or an id,
+// from the given element of the queue.
+typedef uint64_t (*queue_key_function)(queue_element* /* e* */);  // NOLINT
+
+// Sorts the elements of the given queue in place by ascending key, in
+// O(n) time. Like queue_sort, the sort is stable. This is much faster
+// than queue_sort when elements are ordered by an integer key; key_fn
+// is called once per element.
+void queue_sort_by_key(queue* q, queue_key_function key_fn);
+
 #endif  // _QUEUE_H_
 
@@ -0,0 +1,346 @@
+/* Micro-benchmarks for the queue data structures.
+ *
+ * Reports the time per operation, and the number of heap allocations per
+ * operation made by the data structure code. Allocations are counted by
+ * linking with -Wl,--wrap=malloc (see the Makefile), which redirects the
+ * malloc calls in our own object files, but not those inside libc, to
+ * the counting wrappers below.
+ *
+ * Usage: ./queuebench [scale]
+ * where scale (default 1) multiplies the number of operations run. */
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "deque.h"
+#include "iqueue.h"
+#include "mpmc_queue.h"
+#include "pqueue.h"
+#include "queue.h"
+#include "spsc_ring.h"
+
+static const size_t kBaseOps = 1000000;
+static const int kMaxThreads = 8;
+
+static size_t allocations = 0;
+
+void* __real_malloc(size_t size);
+void* __real_realloc(void* ptr, size_t size);
+int __real_posix_memalign(void** ptr, size_t alignment, size_t size);
+
+void* __wrap_malloc(size_t size) {
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  return __real_malloc(size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void** ptr, size_t alignment, size_t size) {
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  return __real_posix_memalign(ptr, alignment, size);
+}
+
+/* Returns the current time in nanoseconds. */
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Times are measured from start_timer() to report(). */
+static uint64_t start_ns;
+static size_t start_allocations;
+
+static void start_timer() {
+  start_allocations = allocations;
+  start_ns = now_ns();
+}
+
+static void report(const char* name, size_t ops) {
+  uint64_t elapsed = now_ns() - start_ns;
+  size_t allocs = allocations - start_allocations;
+
+  printf("%-36s %10.2f ns/op %10.4f allocs/op\n", name,
+         (double) elapsed / ops, (double) allocs / ops);
+}
+
+static int compare_elem(queue_element* e1, queue_element* e2) {
+  uintptr_t i1 = (uintptr_t) e1;
+  uintptr_t i2 = (uintptr_t) e2;
+
+  if (i1 < i2)
+    return -1;
+  if (i1 > i2)
+    return 1;
+  return 0;
+}
+
+static bool sum_one(queue_element* elem, queue_function_args* args) {
+  *(uintptr_t*) args += (uintptr_t) elem;
+  return true;
+}
+
+/* Append/remove throughput of the element queue, with the queue kept at
+ * the given depth so that chunks are recycled. */
+static void bench_queue_fifo(size_t ops, size_t depth) {
+  char name[64];
+  queue* q = queue_create();
+  queue_element* elem;
+
+  for (size_t i = 0; i < depth; i++)
+    queue_append(q, (queue_element*) i);
+
+  start_timer();
+  for (size_t i = 0; i < ops; i++) {
+    queue_append(q, (queue_element*) i);
+    queue_remove(q, &elem);
+  }
+  snprintf(name, sizeof(name), "queue append+remove (depth %zu)", depth);
+  report(name, ops);
+
+  queue_destroy(q);
+}
+
+/* Append/remove throughput of the element queue in batches. */
+static void bench_queue_batch(size_t ops) {
+  queue_element* batch[64];
+  queue* q = queue_create();
+
+  for (size_t i = 0; i < 64; i++)
+    batch[i] = (queue_element*) i;
+
+  start_timer();
+  for (size_t i = 0; i < ops; i += 64) {
+    queue_append_n(q, batch, 64);
+    queue_drain(q, batch, 64);
+  }
+  report("queue append_n+drain (64)", ops);
+
+  queue_destroy(q);
+}
+
+/* Append/remove throughput of the intrusive queue. */
+static void bench_iqueue_fifo(size_t ops) {
+  queue_link links[64];
+  queue_link* ql;
+  iqueue q;
+
+  iqueue_init(&q);
+  for (size_t i = 0; i < 64; i++)
+    iqueue_append(&q, &links[i]);
+
+  start_timer();
+  for (size_t i = 0; i < ops; i++) {
+    iqueue_remove(&q, &ql);
+    iqueue_append(&q, ql);
+  }
+  report("iqueue remove+append", ops);
+}
+
+/* Push/pop throughput of the deque used as a stack at the back. */
+static void bench_deque_lifo(size_t ops) {
+  deque* d = deque_create();
+  queue_element* elem;
+
+  for (size_t i = 0; i < 64; i++)
+    deque_push_back(d, (queue_element*) i);
+
+  start_timer();
+  for (size_t i = 0; i < ops; i++) {
+    deque_push_back(d, (queue_element*) i);
+    deque_pop_back(d, &elem);
+  }
+  report("deque push_back+pop_back", ops);
+
+  deque_destroy(d);
+}
+
+/* Push/pop throughput of the priority queue at the given depth. */
+static void bench_pqueue(size_t ops, size_t depth) {
+  char name[64];
+  pqueue* pq = pqueue_create(compare_elem);
+  unsigned int seed = 451;
+  queue_element* elem;
+
+  for (size_t i = 0; i < depth; i++)
+    pqueue_push(pq, (queue_element*) (uintptr_t) rand_r(&seed));
+
+  start_timer();
+  for (size_t i = 0; i < ops; i++) {
+    pqueue_push(pq, (queue_element*) (uintptr_t) rand_r(&seed));
+    pqueue_pop_min(pq, &elem);
+  }
+  snprintf(name, sizeof(name), "pqueue push+pop_min (depth %zu)", depth);
+  report(name, ops);
+
+  pqueue_destroy(pq);
+}
+
+/* Iteration bandwidth of queue_apply. */
+static void bench_queue_apply(size_t size) {
+  char name[64];
+  queue* q = queue_create();
+  uintptr_t sum = 0;
+
+  for (size_t i = 0; i < size; i++)
+    queue_append(q, (queue_element*) i);
+
+  start_timer();
+  for (int rep = 0; rep < 10; rep++)
+    queue_apply(q, sum_one, &sum);
+  snprintf(name, sizeof(name), "queue apply (%zu elements)", size);
+  report(name, 10 * size);
+  assert(sum == 10 * (size * (size - 1) / 2));
+
+  queue_destroy(q);
+}
+
+/* Sort time against queue size. */
+static void bench_queue_sort(size_t size) {
+  char name[64];
+  queue* q = queue_create();
+  unsigned int seed = 451;
+
+  for (size_t i = 0; i < size; i++)
+    queue_append(q, (queue_element*) (uintptr_t) rand_r(&seed));
+
+  start_timer();
+  queue_sort(q, compare_elem);
+  snprintf(name, sizeof(name), "queue sort (%zu elements)", size);
+  report(name, size);
+
+  queue_destroy(q);
+}
+
+static uint64_t elem_key(queue_element* elem) {
+  return (uint64_t) (uintptr_t) elem;
+}
+
+/* Radix sort time against queue size. */
+static void bench_queue_sort_by_key(size_t size) {
+  char name[64];
+  queue* q = queue_create();
+  unsigned int seed = 451;
+
+  for (size_t i = 0; i < size; i++)
+    queue_append(q, (queue_element*) (uintptr_t) rand_r(&seed));
+
+  start_timer();
+  queue_sort_by_key(q, elem_key);
+  snprintf(name, sizeof(name), "queue sort_by_key (%zu elements)", size);
+  report(name, size);
+
+  queue_destroy(q);
+}
+
+/* Contention benchmarks: nthreads producers and nthreads consumers pass
+ * items_per_thread items each through the queue under test. */
+typedef struct {
+  mpmc_queue* mq;
+  spsc_ring* ring;
+  size_t items;
+} contention_args;
+
+static void* mpmc_producer(void* arg) {
+  contention_args* args = (contention_args*) arg;
+  for (size_t i = 1; i <= args->items; i++) {
+    while (!mpmc_queue_push(args->mq, (queue_element*) i))
+      sched_yield();
+  }
+  return NULL;
+}
+
+static void* mpmc_consumer(void* arg) {
+  contention_args* args = (contention_args*) arg;
+  queue_element* elem;
+  for (size_t i = 0; i < args->items; i++) {
+    while (!mpmc_queue_pop(args->mq, &elem))
+      sched_yield();
+  }
+  return NULL;
+}
+
+static void bench_mpmc(size_t items_per_thread, int nthreads) {
+  char name[64];
+  pthread_t threads[2 * kMaxThreads];
+  contention_args args = { mpmc_queue_create(1024), NULL, items_per_thread };
+
+  start_timer();
+  for (int i = 0; i < nthreads; i++) {
+    pthread_create(&threads[2 * i], NULL, mpmc_producer, &args);
+    pthread_create(&threads[2 * i + 1], NULL, mpmc_consumer, &args);
+  }
+  for (int i = 0; i < 2 * nthreads; i++)
+    pthread_join(threads[i], NULL);
+  snprintf(name, sizeof(name), "mpmc push+pop (%d+%d threads)",
+           nthreads, nthreads);
+  report(name, nthreads * items_per_thread);
+
+  mpmc_queue_destroy(args.mq);
+}
+
+static void* spsc_producer(void* arg) {
+  contention_args* args = (contention_args*) arg;
+  for (size_t i = 1; i <= args->items; i++) {
+    while (!spsc_ring_push(args->ring, (queue_element*) i))
+      sched_yield();
+  }
+  return NULL;
+}
+
+static void bench_spsc(size_t items) {
+  pthread_t producer;
+  contention_args args = { NULL, spsc_ring_create(1024), items };
+  queue_element* elem;
+
+  start_timer();
+  pthread_create(&producer, NULL, spsc_producer, &args);
+  for (size_t i = 0; i < items; i++) {
+    while (!spsc_ring_pop(args.ring, &elem))
+      sched_yield();
+  }
+  pthread_join(producer, NULL);
+  report("spsc push+pop (1+1 threads)", items);
+
+  spsc_ring_destroy(args.ring);
+}
+
+int main(int argc, char* argv[]) {
+  size_t scale = 1;
+  if (argc > 1 && atoi(argv[1]) > 0)
+    scale = atoi(argv[1]);
+  size_t ops = kBaseOps * scale;
+
+  printf("-- single-threaded append/remove\n");
+  bench_queue_fifo(ops, 0);
+  bench_queue_fifo(ops, 1000);
+  bench_queue_batch(ops);
+  bench_iqueue_fifo(ops);
+  bench_deque_lifo(ops);
+  bench_pqueue(ops, 1000);
+
+  printf("-- iteration\n");
+  bench_queue_apply(1000);
+  bench_queue_apply(ops);
+
+  printf("-- sort (ns per element)\n");
+  for (size_t size = 1000; size <= ops; size *= 10)
+    bench_queue_sort(size);
+  for (size_t size = 1000; size <= ops; size *= 10)
+    bench_queue_sort_by_key(size);
+
+  printf("-- contention\n");
+  bench_spsc(ops);
+  for (int nthreads = 1; nthreads <= kMaxThreads; nthreads *= 2)
+    bench_mpmc(ops / nthreads, nthreads);
+
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include "queue.h"
 
 // Print out the index and the value of each element.
@@ -20,6 +22,182 @@ int compare_elem(queue_element* e1, queue_element* e2) {
   return 0;
 }
 
+// Append and remove enough elements to span many chunks of the queue,
+// interleaving the two so that chunks are emptied and recycled.
+void test_many_elements() {
+  static int values[1000];
+  queue* q = queue_create();
+  assert(q != NULL);
+
+  for (int i = 0; i < 1000; i++)
+    values[i] = i;
+
+  int next_in = 0;
+  int next_out = 0;
+  for (int round = 0; round < 10; round++) {
+    for (int i = 0; i < 70; i++)
+      queue_append(q, &values[next_in++]);
+    for (int i = 0; i < 50; i++) {
+      queue_element* elem;
+      bool removed = queue_remove(q, &elem);
+      assert(removed);
+      assert(*(int*) elem == next_out);
+      next_out++;
+    }
+    assert(queue_size(q) == next_in - next_out);
+  }
+
+  while (!queue_is_empty(q)) {
+    queue_element* elem;
+    bool removed = queue_remove(q, &elem);
+    assert(removed);
+    assert(*(int*) elem == next_out);
+    next_out++;
+  }
+  assert(next_out == next_in);
+
+  queue_destroy(q);
+}
+
+// A record that is sorted by key only, remembering its insertion order.
+typedef struct {
+  int key;
+  int seq;
+} record;
+
+int compare_record(queue_element* e1, queue_element* e2) {
+  return compare_elem(&((record*) e1)->key, &((record*) e2)->key);
+}
+
+// Sort and reverse a queue much larger than a chunk, checking that the
+// sort orders by key and keeps records with equal keys in insertion order.
+void test_sort_large() {
+  const int n = 100000;
+  unsigned int seed = 451;
+  record* records = (record*) malloc(n * sizeof(record));
+  assert(records != NULL);
+  queue* q = queue_create();
+  assert(q != NULL);
+
+  for (int i = 0; i < n; i++) {
+    records[i].key = rand_r(&seed) % 1000;
+    records[i].seq = i;
+    queue_append(q, &records[i]);
+  }
+
+  queue_sort(q, &compare_record);
+  assert(queue_size(q) == n);
+  queue_reverse(q);
+  queue_reverse(q);
+
+  record* prev = NULL;
+  queue_element* elem;
+  while (queue_remove(q, &elem)) {
+    record* cur = (record*) elem;
+    if (prev != NULL) {
+      assert(prev->key <= cur->key);
+      assert(prev->key < cur->key || prev->seq < cur->seq);
+    }
+    prev = cur;
+  }
+
+  queue_destroy(q);
+  free(records);
+}
+
+// Move elements in and out of queues in batches, and concatenate
+// queues, checking that everything stays in FIFO order.
+void test_batches() {
+  static int values[300];
+  queue_element* elems[300];
+  queue* q = queue_create();
+  queue* other = queue_create();
+  assert(q != NULL && other != NULL);
+
+  for (int i = 0; i < 300; i++) {
+    values[i] = i;
+    elems[i] = &values[i];
+  }
+
+  // q: 0..99, other: 100..299
+  queue_append_n(q, elems, 100);
+  queue_append_n(other, elems + 100, 200);
+  assert(queue_size(q) == 100);
+  assert(queue_size(other) == 200);
+
+  queue_concat(q, other);
+  assert(queue_size(q) == 300);
+  assert(queue_is_empty(other));
+  queue_concat(q, other);
+  assert(queue_size(q) == 300);
+
+  // drain in uneven batches across the chunk boundaries
+  queue_element* out[70];
+  int next = 0;
+  size_t n;
+  while ((n = queue_drain(q, out, 70)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      assert(*(int*) out[i] == next);
+      next++;
+    }
+  }
+  assert(next == 300);
+  assert(queue_is_empty(q));
+
+  // concatenating onto an emptied queue
+  queue_append(other, &values[0]);
+  queue_concat(q, other);
+  queue_append(q, &values[1]);
+  assert(queue_drain(q, out, 70) == 2);
+  assert(*(int*) out[0] == 0 && *(int*) out[1] == 1);
+
+  queue_destroy(other);
+  queue_destroy(q);
+}
+
+uint64_t record_key(queue_element* elem) {
+  return (uint64_t) ((record*) elem)->key;
+}
+
+// Sort small and large queues of records by key, checking that records
+// come out by key and that records with equal keys keep insertion order.
+void test_sort_by_key() {
+  const int sizes[] = { 0, 1, 2, 100, 255, 256, 5000, 100000 };
+  unsigned int seed = 451;
+
+  for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    int n = sizes[s];
+    record* records = (record*) malloc((n + 1) * sizeof(*records));
+    assert(records != NULL);
+    queue* q = queue_create();
+    assert(q != NULL);
+
+    for (int i = 0; i < n; i++) {
+      // spread the keys over more than one byte
+      records[i].key = rand_r(&seed) % 70000;
+      records[i].seq = i;
+      queue_append(q, &records[i]);
+    }
+
+    queue_sort_by_key(q, &record_key);
+    assert(queue_size(q) == n);
+
+    record* prev = NULL;
+    queue_element* elem;
+    while (queue_remove(q, &elem)) {
+      record* cur = (record*) elem;
+      if (prev != NULL) {
+        assert(prev->key <= cur->key);
+        assert(prev->key < cur->key || prev->seq < cur->seq);
+      }
+      prev = cur;
+    }
+
+    queue_destroy(q);
+    free(records);
+  }
+}
+
 int main(int argc, char* argv[]) {
   queue* q = queue_create();
   assert(q != NULL);
@@ -131,5 +309,10 @@ int main(int argc, char* argv[]) {
   queue_destroy(q);
   q = NULL;
 
+  test_many_elements();
+  test_sort_large();
+  test_batches();
+  test_sort_by_key();
+
   return 0;
 }
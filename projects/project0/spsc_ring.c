@@ -0,0 +1,139 @@
+/* Implements the single-producer/single-consumer ring. */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "spsc_ring.h"
+
+/* Size of a cache line. The producer's and the consumer's fields each
+ * get a cache line of their own. */
+#define SPSC_CACHE_LINE 64
+
+/* Positions only ever grow; slot i of the ring holds the element at any
+ * position p with p & mask == i. The ring holds tail - head elements. */
+struct _spsc_ring {
+  queue_element** slots;
+  size_t mask;  // capacity - 1
+
+  // written by the producer only
+  size_t tail __attribute__((aligned(SPSC_CACHE_LINE)));
+  size_t cached_head;  // the producer's last look at head
+
+  // written by the consumer only
+  size_t head __attribute__((aligned(SPSC_CACHE_LINE)));
+  size_t cached_tail;  // the consumer's last look at tail
+} __attribute__((aligned(SPSC_CACHE_LINE)));
+
+spsc_ring* spsc_ring_create(size_t capacity) {
+  // round the capacity up to a power of two so positions can be
+  // mapped to slots with a mask
+  size_t size = 2;
+  while (size < capacity)
+    size *= 2;
+
+  spsc_ring* r;
+  if (posix_memalign((void**) &r, SPSC_CACHE_LINE, sizeof(*r)) != 0)
+    return NULL;
+  r->slots = (queue_element**) malloc(size * sizeof(*r->slots));
+  if (r->slots == NULL) {
+    free(r);
+    return NULL;
+  }
+
+  r->mask = size - 1;
+  r->tail = 0;
+  r->cached_head = 0;
+  r->head = 0;
+  r->cached_tail = 0;
+
+  return r;
+}
+
+void spsc_ring_destroy(spsc_ring* r) {
+  if (r != NULL) {
+    free(r->slots);
+    free(r);
+  }
+}
+
+/* Private: returns how many slots the producer can fill right now,
+ * refreshing its cached copy of head only if the ring looks full. */
+static size_t spsc_ring_free_slots(spsc_ring* r, size_t want) {
+  size_t capacity = r->mask + 1;
+  size_t free_slots = capacity - (r->tail - r->cached_head);
+
+  if (free_slots < want) {
+    r->cached_head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    free_slots = capacity - (r->tail - r->cached_head);
+  }
+
+  return free_slots;
+}
+
+/* Private: returns how many elements the consumer can take right now,
+ * refreshing its cached copy of tail only if the ring looks empty. */
+static size_t spsc_ring_used_slots(spsc_ring* r, size_t want) {
+  size_t used_slots = r->cached_tail - r->head;
+
+  if (used_slots < want) {
+    r->cached_tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    used_slots = r->cached_tail - r->head;
+  }
+
+  return used_slots;
+}
+
+bool spsc_ring_push(spsc_ring* r, queue_element* elem) {
+  assert(r != NULL);
+
+  if (spsc_ring_free_slots(r, 1) == 0)
+    return false;
+
+  r->slots[r->tail & r->mask] = elem;
+  // publish the element to the consumer
+  __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+size_t spsc_ring_push_n(spsc_ring* r, queue_element** elems, size_t n) {
+  assert(r != NULL);
+  assert(elems != NULL || n == 0);
+
+  size_t count = spsc_ring_free_slots(r, n);
+  if (count > n)
+    count = n;
+
+  for (size_t i = 0; i < count; i++)
+    r->slots[(r->tail + i) & r->mask] = elems[i];
+  // publish the whole batch to the consumer at once
+  __atomic_store_n(&r->tail, r->tail + count, __ATOMIC_RELEASE);
+  return count;
+}
+
+bool spsc_ring_pop(spsc_ring* r, queue_element** elem_ptr) {
+  assert(r != NULL);
+  assert(elem_ptr != NULL);
+
+  if (spsc_ring_used_slots(r, 1) == 0)
+    return false;
+
+  *elem_ptr = r->slots[r->head & r->mask];
+  // hand the slot back to the producer
+  __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+size_t spsc_ring_pop_n(spsc_ring* r, queue_element** out, size_t max) {
+  assert(r != NULL);
+  assert(out != NULL || max == 0);
+
+  size_t count = spsc_ring_used_slots(r, max);
+  if (count > max)
+    count = max;
+
+  for (size_t i = 0; i < count; i++)
+    out[i] = r->slots[(r->head + i) & r->mask];
+  // hand all the slots back to the producer at once
+  __atomic_store_n(&r->head, r->head + count, __ATOMIC_RELEASE);
+  return count;
+}
@@ -0,0 +1,62 @@
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "queue.h"
+
+/* Definitions for a bounded single-producer/single-consumer ring. It is
+ * meant for handing elements from one pipeline stage to the next, where
+ * exactly one thread ever pushes and exactly one other thread ever pops.
+ * Under that rule no operation takes a lock or a compare-and-swap, and
+ * neither side ever waits for the other: push and pop are wait-free.
+ *
+ * Each side keeps its own index on its own cache line, together with a
+ * cached copy of the other side's index, so it only reads the other
+ * side's cache line when the cached copy says the ring is full (or
+ * empty). The _n variants move a whole batch and publish it to the other
+ * side with one store.
+ *
+ * Push and pop never block: they return false (or 0) when the ring is
+ * full or empty. */
+
+// Forward declaration of the ring struct. The actual definition
+// is in spsc_ring.c.
+typedef struct _spsc_ring spsc_ring;
+
+/*
+ * Creates and returns a new ring that holds at least capacity elements.
+ * The capacity is rounded up to a power of two.
+ */
+spsc_ring* spsc_ring_create(size_t capacity);
+
+/*
+ * Destroys the ring. Neither side may be using it.
+ */
+void spsc_ring_destroy(spsc_ring* r);
+
+/*
+ * Producer only: appends an element to the ring. Returns false if the
+ * ring is full.
+ */
+bool spsc_ring_push(spsc_ring* r, queue_element* elem);
+
+/*
+ * Producer only: appends as many of the n elements of the given array as
+ * fit, in array order, and returns how many were appended.
+ */
+size_t spsc_ring_push_n(spsc_ring* r, queue_element** elems, size_t n);
+
+/* Consumer only: removes the first element from the ring and leaves it
+ *   in elem_ptr. Returns false if the ring is empty.
+ */
+bool spsc_ring_pop(spsc_ring* r, queue_element** elem_ptr);
+
+/*
+ * Consumer only: removes up to max elements into out, in ring order, and
+ * returns how many were removed.
+ */
+size_t spsc_ring_pop_n(spsc_ring* r, queue_element** out, size_t max);
+
+#endif  // _SPSC_RING_H_
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include "spsc_ring.h"
+
+#define NUM_ITEMS 1000000
+#define BATCH 16
+
+static spsc_ring* r;
+
+// Pushes the values 1..NUM_ITEMS, alternating single and batched pushes.
+void* producer(void* arg) {
+  uintptr_t next = 1;
+
+  while (next <= NUM_ITEMS) {
+    if (next % 2 == 0) {
+      queue_element* batch[BATCH];
+      size_t n = 0;
+      while (n < BATCH && next + n <= NUM_ITEMS) {
+        batch[n] = (queue_element*) (next + n);
+        n++;
+      }
+      size_t pushed = spsc_ring_push_n(r, batch, n);
+      if (pushed == 0)
+        sched_yield();
+      next += pushed;
+    } else if (spsc_ring_push(r, (queue_element*) next)) {
+      next++;
+    } else {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char* argv[]) {
+  queue_element* elem;
+  queue_element* out[BATCH];
+  int x = 0;
+  int y = 1;
+
+  r = spsc_ring_create(2);
+  assert(r != NULL);
+  bool ok = spsc_ring_pop(r, &elem);
+  assert(!ok);
+  ok = spsc_ring_push(r, &x);
+  assert(ok);
+  ok = spsc_ring_push(r, &y);
+  assert(ok);
+  ok = spsc_ring_push(r, &x);
+  assert(!ok);
+  ok = spsc_ring_pop(r, &elem);
+  assert(ok && elem == &x);
+  size_t taken = spsc_ring_pop_n(r, out, BATCH);
+  assert(taken == 1 && out[0] == &y);
+  taken = spsc_ring_pop_n(r, out, BATCH);
+  assert(taken == 0);
+  spsc_ring_destroy(r);
+
+  // stream values through a small ring and check they arrive in order
+  r = spsc_ring_create(64);
+  assert(r != NULL);
+
+  pthread_t producer_thread;
+  if (pthread_create(&producer_thread, NULL, producer, NULL) != 0) {
+    perror("pthread_create");
+    return 1;
+  }
+
+  uintptr_t expected = 1;
+  while (expected <= NUM_ITEMS) {
+    if (expected % 3 == 0) {
+      size_t n = spsc_ring_pop_n(r, out, BATCH);
+      if (n == 0)
+        sched_yield();
+      for (size_t i = 0; i < n; i++) {
+        assert((uintptr_t) out[i] == expected);
+        expected++;
+      }
+    } else if (spsc_ring_pop(r, &elem)) {
+      assert((uintptr_t) elem == expected);
+      expected++;
+    } else {
+      sched_yield();
+    }
+  }
+
+  pthread_join(producer_thread, NULL);
+  ok = spsc_ring_pop(r, &elem);
+  assert(!ok);
+  spsc_ring_destroy(r);
+
+  printf("spsctest passed\n");
+  return 0;
+}
@@ -0,0 +1,251 @@
+/* Micro-benchmarks for the sthread library.
+ *
+ * Reports the time per operation of context switches, thread creation,
+ * mutexes, condition variables and a producer/consumer queue. The
+ * backend is chosen when the library is configured, so to compare the
+ * user-level threads with pthreads, build and run this once after
+ * ./configure and once after ./configure --with-pthreads.
+ *
+ * Usage: ./sthread-bench [scale]
+ * where scale (default 1) multiplies the number of operations run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sthread.h>
+
+#define BASE_OPS 100000
+#define NUM_CONTENDERS 4
+#define BUFFER_SIZE 64
+
+/* Returns the current time in nanoseconds. */
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Times are measured from start_timer() to report(). */
+static uint64_t start_ns;
+
+static void start_timer(void) {
+  start_ns = now_ns();
+}
+
+static void report(const char *name, long ops) {
+  uint64_t elapsed = now_ns() - start_ns;
+  printf("%-36s %12.1f ns/op\n", name, (double)elapsed / ops);
+  fflush(stdout);
+}
+
+/* Yield ping-pong: two threads yield to each other; one op is one
+ * switch. */
+static long yield_iterations;
+
+static void *yield_loop(void *arg) {
+  long i;
+  for (i = 0; i < yield_iterations; i++)
+    sthread_yield();
+  return NULL;
+}
+
+static void bench_yield(long ops) {
+  sthread_t a, b;
+
+  yield_iterations = ops / 2;
+  start_timer();
+  a = sthread_create(yield_loop, NULL, 1);
+  b = sthread_create(yield_loop, NULL, 1);
+  sthread_join(a);
+  sthread_join(b);
+  report("yield ping-pong (per switch)", ops);
+}
+
+/* Create+join: one op creates a thread and waits for it to finish. */
+static void *empty_start(void *arg) {
+  return arg;
+}
+
+static void bench_create_join(long ops) {
+  long i;
+
+  start_timer();
+  for (i = 0; i < ops; i++)
+    sthread_join(sthread_create(empty_start, NULL, 1));
+  report("create+join", ops);
+}
+
+/* Mutex: one op is a lock/unlock pair. */
+static sthread_mutex_t mutex;
+static long counter;
+static long contender_iterations;
+
+static void bench_mutex_uncontended(long ops) {
+  long i;
+
+  start_timer();
+  for (i = 0; i < ops; i++) {
+    sthread_mutex_lock(mutex);
+    counter++;
+    sthread_mutex_unlock(mutex);
+  }
+  report("mutex lock+unlock (uncontended)", ops);
+}
+
+static void *contender(void *arg) {
+  long i;
+  for (i = 0; i < contender_iterations; i++) {
+    sthread_mutex_lock(mutex);
+    counter++;
+    sthread_mutex_unlock(mutex);
+  }
+  return NULL;
+}
+
+static void bench_mutex_contended(long ops) {
+  sthread_t threads[NUM_CONTENDERS];
+  int i;
+
+  counter = 0;
+  contender_iterations = ops / NUM_CONTENDERS;
+  start_timer();
+  for (i = 0; i < NUM_CONTENDERS; i++)
+    threads[i] = sthread_create(contender, NULL, 1);
+  for (i = 0; i < NUM_CONTENDERS; i++)
+    sthread_join(threads[i]);
+  report("mutex lock+unlock (4 threads)", ops);
+
+  if (counter != contender_iterations * NUM_CONTENDERS) {
+    printf("mutex benchmark lost updates: %ld\n", counter);
+    exit(1);
+  }
+}
+
+/* Condition variable ping-pong: two threads take turns, each signalling
+ * the other and waiting for its turn; one op is one signal-to-wakeup
+ * handoff. */
+static sthread_cond_t turn_cond;
+static int turn;
+static long handoff_iterations;
+
+static void *handoff_loop(void *arg) {
+  int me = (int)(intptr_t)arg;
+  long i;
+
+  sthread_mutex_lock(mutex);
+  for (i = 0; i < handoff_iterations; i++) {
+    while (turn != me)
+      sthread_cond_wait(turn_cond, mutex);
+    turn = !me;
+    sthread_cond_signal(turn_cond);
+  }
+  sthread_mutex_unlock(mutex);
+  return NULL;
+}
+
+static void bench_cond_handoff(long ops) {
+  sthread_t a, b;
+
+  turn = 0;
+  handoff_iterations = ops / 2;
+  start_timer();
+  a = sthread_create(handoff_loop, (void *)0, 1);
+  b = sthread_create(handoff_loop, (void *)1, 1);
+  sthread_join(a);
+  sthread_join(b);
+  report("condvar signal-to-wakeup", ops);
+}
+
+/* Producer/consumer: a bounded buffer protected by a mutex and two
+ * condition variables; one op is one item passed through. */
+static sthread_cond_t not_empty;
+static sthread_cond_t not_full;
+static long buffer[BUFFER_SIZE];
+static int buffer_head;
+static int buffer_count;
+static long items_per_thread;
+
+static void *producer(void *arg) {
+  long i;
+  for (i = 0; i < items_per_thread; i++) {
+    sthread_mutex_lock(mutex);
+    while (buffer_count == BUFFER_SIZE)
+      sthread_cond_wait(not_full, mutex);
+    buffer[(buffer_head + buffer_count) % BUFFER_SIZE] = i;
+    buffer_count++;
+    sthread_cond_signal(not_empty);
+    sthread_mutex_unlock(mutex);
+  }
+  return NULL;
+}
+
+static void *consumer(void *arg) {
+  long i;
+  long sum = 0;
+  for (i = 0; i < items_per_thread; i++) {
+    sthread_mutex_lock(mutex);
+    while (buffer_count == 0)
+      sthread_cond_wait(not_empty, mutex);
+    sum += buffer[buffer_head];
+    buffer_head = (buffer_head + 1) % BUFFER_SIZE;
+    buffer_count--;
+    sthread_cond_signal(not_full);
+    sthread_mutex_unlock(mutex);
+  }
+  return (void *)sum;
+}
+
+static void bench_producer_consumer(long ops, int pairs) {
+  sthread_t threads[2 * NUM_CONTENDERS];
+  char name[64];
+  int i;
+
+  buffer_head = 0;
+  buffer_count = 0;
+  items_per_thread = ops / pairs;
+  start_timer();
+  for (i = 0; i < pairs; i++) {
+    threads[2 * i] = sthread_create(producer, NULL, 1);
+    threads[2 * i + 1] = sthread_create(consumer, NULL, 1);
+  }
+  for (i = 0; i < 2 * pairs; i++)
+    sthread_join(threads[i]);
+  snprintf(name, sizeof(name), "producer/consumer (%d+%d threads)",
+           pairs, pairs);
+  report(name, ops);
+}
+
+int main(int argc, char **argv) {
+  long scale = 1;
+  long ops;
+
+  if (argc > 1 && atol(argv[1]) > 0)
+    scale = atol(argv[1]);
+  ops = BASE_OPS * scale;
+
+  printf("sthread benchmarks, impl: %s\n",
+         (sthread_get_impl() == STHREAD_PTHREAD_IMPL) ? "pthread" : "user");
+
+  sthread_init();
+
+  mutex = sthread_mutex_init();
+  turn_cond = sthread_cond_init();
+  not_empty = sthread_cond_init();
+  not_full = sthread_cond_init();
+
+  bench_yield(ops);
+  bench_create_join(ops / 10);
+  bench_mutex_uncontended(10 * ops);
+  bench_mutex_contended(ops);
+  bench_cond_handoff(ops);
+  bench_producer_consumer(ops, 1);
+  bench_producer_consumer(ops, NUM_CONTENDERS);
+
+  sthread_cond_free(not_full);
+  sthread_cond_free(not_empty);
+  sthread_cond_free(turn_cond);
+  sthread_mutex_free(mutex);
+  return 0;
+}
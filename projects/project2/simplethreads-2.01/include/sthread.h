@@ -7,6 +7,10 @@
 #ifndef STHREAD_H
 #define STHREAD_H 1
 
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
 /* Define the sthread_t type (a pointer to an _sthread structure)
  * without knowing how it is actually implemented (that detail is
  * hidden from the public API).
@@ -33,6 +37,15 @@ sthread_impl_t sthread_get_impl(void);
  */
 void sthread_init();
 
+/* Set the number of kernel threads ("carriers") that the user-level
+ * implementation runs sthreads on. Must be called before sthread_init;
+ * the default is 1, or the value of the STHREAD_CARRIERS environment
+ * variable. With more than one carrier, sthreads run in parallel on
+ * several CPUs. The pthread implementation ignores this, since every
+ * sthread is already a kernel thread.
+ */
+void sthread_set_concurrency(int ncarriers);
+
 /* Create a new thread starting at the routine given, which will
  * be passed arg. The new thread does not necessarily execute immediatly
  * (as in, sthread_create shouldn't force a switch to the new thread).
@@ -42,6 +55,47 @@ void sthread_init();
 sthread_t sthread_create(sthread_start_func_t start_routine, void *arg,
 		int joinable);
 
+/* Attributes of a new thread, for sthread_create_attr. Initialize an
+ * sthread_attr_t with sthread_attr_init, then change the fields you
+ * care about.
+ */
+typedef struct {
+  /* Size of the thread's stack in bytes, or 0 for the default (2 MB).
+   * Threads that do little more than block on I/O can run in a few tens
+   * of KB, which lets far more of them exist at once. */
+  size_t stack_size;
+  /* Name of the thread, for debugging. The string is not copied and
+   * must outlive the thread. May be NULL. */
+  const char *name;
+  /* Scheduling hint: threads with a higher priority should be given the
+   * CPU more readily. 0 is normal. Implementations may ignore it. */
+  int priority;
+  /* If nonzero, the thread will never be joined (the opposite of
+   * sthread_create's joinable flag). */
+  int detached;
+} sthread_attr_t;
+
+/* Set attr to the defaults: default stack size, no name, normal
+ * priority, joinable.
+ */
+void sthread_attr_init(sthread_attr_t *attr);
+
+/* Set the preemption quantum, in microseconds, of threads whose
+ * priority is below normal (priority < 0), normal (0) or above normal
+ * (priority > 0): a running thread is preempted after its quantum if
+ * another thread is ready to run. The defaults are 2, 4 and 8 ms.
+ * The quantum is measured in CPU time, which the kernel only checks at
+ * its scheduler tick (1 to 4 ms), so shorter quanta are rounded up.
+ * The pthread implementation ignores this.
+ */
+void sthread_set_quantum(int priority, int usec);
+
+/* Like sthread_create, but with the given attributes. If attr is NULL,
+ * the defaults are used.
+ */
+sthread_t sthread_create_attr(sthread_start_func_t start_routine, void *arg,
+                              const sthread_attr_t *attr);
+
 /* Exit the calling thread with return value ret.
  * Note: In this version of simplethreads, there is no way
  * to retrieve the return value.
@@ -106,4 +160,25 @@ void sthread_cond_broadcast(sthread_cond_t cond);
  * 3. Sleeps thread until awoken. */
 void sthread_cond_wait(sthread_cond_t cond, sthread_mutex_t lock);
 
+/* I/O that blocks only the calling thread. These behave like read(2),
+ * write(2), accept(2) and sendfile(2), but with user-level threads a
+ * call that would block parks the calling thread, and lets other
+ * threads run until the file descriptor is ready, rather than blocking
+ * the kernel thread under it. Several threads may wait on one file
+ * descriptor, for example a reader and a writer on a socket.
+ *
+ * Reads and writes leave the file descriptor's flags as they found
+ * them; a pipe or terminal is put in nonblocking mode only while the
+ * call runs. With user-level threads, though, sthread_accept puts the
+ * listening socket in nonblocking mode and returns a nonblocking
+ * socket, and sthread_sendfile puts out_fd in nonblocking mode, which
+ * other code using them will see. The pthread implementation just
+ * makes the system call.
+ */
+ssize_t sthread_read(int fd, void *buf, size_t count);
+ssize_t sthread_write(int fd, const void *buf, size_t count);
+int sthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+ssize_t sthread_sendfile(int out_fd, int in_fd, off_t *offset,
+                         size_t count);
+
 #endif /* STHREAD_H */
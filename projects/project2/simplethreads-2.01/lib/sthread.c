@@ -14,6 +14,7 @@
 #include <sthread.h>
 #include <sthread_pthread.h>
 #include <sthread_user.h>
+#include <sthread_io.h>
 
 #ifdef USE_PTHREADS
 #define IMPL_CHOOSE(pthread, user) pthread
@@ -25,6 +26,11 @@ void sthread_init(void) {
   IMPL_CHOOSE(sthread_pthread_init(), sthread_user_init());
 }
 
+void sthread_set_concurrency(int ncarriers) {
+  IMPL_CHOOSE(sthread_pthread_set_concurrency(ncarriers),
+              sthread_user_set_concurrency(ncarriers));
+}
+
 sthread_t sthread_create(sthread_start_func_t start_routine, void *arg,
                          int joinable) {
   sthread_t newth;
@@ -33,6 +39,33 @@ sthread_t sthread_create(sthread_start_func_t start_routine, void *arg,
   return newth;
 }
 
+void sthread_attr_init(sthread_attr_t *attr) {
+  assert(attr != NULL);
+  attr->stack_size = 0;
+  attr->name = NULL;
+  attr->priority = 0;
+  attr->detached = 0;
+}
+
+void sthread_set_quantum(int priority, int usec) {
+  IMPL_CHOOSE(sthread_pthread_set_quantum(priority, usec),
+              sthread_user_set_quantum(priority, usec));
+}
+
+sthread_t sthread_create_attr(sthread_start_func_t start_routine, void *arg,
+                              const sthread_attr_t *attr) {
+  sthread_attr_t defaults;
+  sthread_t newth;
+
+  if (attr == NULL) {
+    sthread_attr_init(&defaults);
+    attr = &defaults;
+  }
+  IMPL_CHOOSE(newth = sthread_pthread_create_attr(start_routine, arg, attr),
+              newth = sthread_user_create_attr(start_routine, arg, attr));
+  return newth;
+}
+
 void sthread_exit(void *ret) {
   IMPL_CHOOSE(sthread_pthread_exit(ret), sthread_user_exit(ret));
 }
@@ -102,3 +135,32 @@ void sthread_cond_wait(sthread_cond_t cond, sthread_mutex_t lock) {
   IMPL_CHOOSE(sthread_pthread_cond_wait(cond, lock),
               sthread_user_cond_wait(cond, lock));
 }
+
+ssize_t sthread_read(int fd, void *buf, size_t count) {
+  ssize_t ret;
+  IMPL_CHOOSE(ret = sthread_pthread_read(fd, buf, count),
+              ret = sthread_user_read(fd, buf, count));
+  return ret;
+}
+
+ssize_t sthread_write(int fd, const void *buf, size_t count) {
+  ssize_t ret;
+  IMPL_CHOOSE(ret = sthread_pthread_write(fd, buf, count),
+              ret = sthread_user_write(fd, buf, count));
+  return ret;
+}
+
+int sthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+  int ret;
+  IMPL_CHOOSE(ret = sthread_pthread_accept(fd, addr, addrlen),
+              ret = sthread_user_accept(fd, addr, addrlen));
+  return ret;
+}
+
+ssize_t sthread_sendfile(int out_fd, int in_fd, off_t *offset,
+                         size_t count) {
+  ssize_t ret;
+  IMPL_CHOOSE(ret = sthread_pthread_sendfile(out_fd, in_fd, offset, count),
+              ret = sthread_user_sendfile(out_fd, in_fd, offset, count));
+  return ret;
+}
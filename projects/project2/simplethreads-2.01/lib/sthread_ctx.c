@@ -5,13 +5,16 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <assert.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
 
 #include <sthread_ctx.h>
+#include <sthread_preempt.h>
 
 #ifdef STHREAD_CPU_I386
 #include "sthread_switch_i386.h"
@@ -25,20 +28,180 @@
 #include "sthread_switch_powerpc.h"
 #endif
 
+/* Architectures whose saved context needs no initial values beyond
+ * zero don't define this. */
+#ifndef STHREAD_INIT_CONTEXT
+#define STHREAD_INIT_CONTEXT(sp) ((void)0)
+#endif
+
 
 /* Stack size is used to allocate a region of memory for a thread's stack
- * in sthread_new_ctx. pthread_create(3) says that it uses a default stack
- * size of 2 MB, unless this is limited by the RLIMIT_STACK soft resource
+ * in sthread_new_ctx, unless the thread was created with a stack size of
+ * its own. pthread_create(3) says that it uses a default stack size of
+ * 2 MB, unless this is limited by the RLIMIT_STACK soft resource
  * limit. ulimit -s on the UW CSE lab VMs says that this limit is 8192 *
  * 1024 bytes (8 MB). We use 2 MB here to match pthreads.
  */
 const size_t sthread_stack_size = 2 * 1024 * 1024;
 
+/* Smallest stack we hand out; requests below this are rounded up. */
+const size_t sthread_min_stack_size = 16 * 1024;
+
+/* Stacks are mapped with mmap() rather than malloc'd, so that physical
+ * memory is only committed for the pages a thread actually touches; a
+ * mostly idle thread costs a few pages rather than the full 2 MB. Below
+ * each stack is a PROT_NONE guard page, so a thread that overflows its
+ * stack faults instead of silently corrupting its neighbour. */
+
+/* Stacks of exited threads are kept in a cache and handed to new
+ * threads, so that creating a thread does not have to map and fault in
+ * a fresh stack. The cache holds one LIFO list per stack size, for up
+ * to STACK_CACHE_SIZES different sizes at a time; each list is chained
+ * through the topmost word of each cached stack (above the initial
+ * stack pointer, so never used by the thread). The most recently freed
+ * stack is the one most likely to still be in the cache and TLB. The
+ * cache is shared by all carriers and guarded by a spinlock; callers
+ * must have interrupts disabled (splx(HIGH)) once preemption is
+ * running, so that the holder of the spinlock can't be preempted. */
+#define STACK_CACHE_SIZES 4
+#define STACK_CACHE_MAX 64
+
+/* The top STACK_HOT_SIZE bytes of a recycled stack are left resident,
+ * since nearly every thread uses them. Pages below that are given back
+ * to the kernel with madvise() when a thread has used them, which we
+ * find with mincore(), STACK_SCAN_PAGES pages at a time. */
+#define STACK_HOT_SIZE (64 * 1024)
+#define STACK_SCAN_PAGES 256
+
+typedef struct {
+  size_t size;  // size of the stacks in this list
+  char *head;   // most recently freed stack
+  int count;    // number of stacks in this list
+} stack_cache_list;
+
+static stack_cache_list stack_cache[STACK_CACHE_SIZES];
+static lock_t stack_cache_lock;
+
+/* Returns the address of the cache link of the given stack. */
+static char **sthread_stack_link(char *stackbase, size_t size) {
+  return (char **)(stackbase + size) - 1;
+}
+
+/* Returns the size of the guard page(s) below each stack. */
+static size_t sthread_guard_size(void) {
+  return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/* Returns the offset from stackbase of the deepest resident page of the
+ * cold region of a stack, which is the cold_size bytes at its base, or
+ * cold_size if none of those pages is resident. */
+static size_t sthread_stack_low_water(char *stackbase, size_t cold_size) {
+  unsigned char vec[STACK_SCAN_PAGES];
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t off, len, i;
+
+  for (off = 0; off < cold_size; off += len) {
+    len = cold_size - off;
+    if (len > STACK_SCAN_PAGES * page)
+      len = STACK_SCAN_PAGES * page;
+    /* If the kernel can't tell us, assume the rest was used. */
+    if (mincore(stackbase + off, len, vec) != 0)
+      return off;
+    for (i = 0; i < (len + page - 1) / page; i++) {
+      if (vec[i] & 1)
+        return off + i * page;
+    }
+  }
+  return cold_size;
+}
+
+/* Returns the cache list for stacks of the given size, claiming an
+ * empty list for it if there is none yet, or NULL if all lists are in
+ * use by other sizes. */
+static stack_cache_list *sthread_stack_cache_list(size_t size) {
+  stack_cache_list *empty = NULL;
+
+  for (int i = 0; i < STACK_CACHE_SIZES; i++) {
+    if (stack_cache[i].size == size)
+      return &stack_cache[i];
+    if (stack_cache[i].count == 0 && empty == NULL)
+      empty = &stack_cache[i];
+  }
+
+  if (empty != NULL)
+    empty->size = size;
+  return empty;
+}
+
+/* Take a stack of the given size from the cache, or map a new one. */
+static char *sthread_alloc_stack(size_t size) {
+  stack_cache_list *list;
+  size_t guard = sthread_guard_size();
+  char *stackbase = NULL;
+
+  while (atomic_test_and_set(&stack_cache_lock)) {}
+  list = sthread_stack_cache_list(size);
+  if (list != NULL && list->head != NULL) {
+    stackbase = list->head;
+    list->head = *sthread_stack_link(stackbase, size);
+    list->count--;
+  }
+  atomic_clear(&stack_cache_lock);
+  if (stackbase != NULL)
+    return stackbase;
+
+  char *map = (char *)mmap(NULL, guard + size,
+                           PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                           MAP_STACK, -1, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  if (mprotect(map, guard, PROT_NONE) != 0) {
+    munmap(map, guard + size);
+    return NULL;
+  }
+
+  return map + guard;
+}
+
+/* Return a stack to the cache, releasing the memory of its cold pages
+ * if the thread used them, or unmap it if the cache has no room for it. */
+static void sthread_release_stack(char *stackbase, size_t size) {
+  stack_cache_list *list;
+  size_t guard = sthread_guard_size();
+
+  if (size > STACK_HOT_SIZE) {
+    size_t cold_size = size - STACK_HOT_SIZE;
+    size_t low = sthread_stack_low_water(stackbase, cold_size);
+
+    /* The thread ran deeper than the hot region; the pages it touched
+     * read back as zero after this. */
+    if (low < cold_size)
+      madvise(stackbase + low, cold_size - low, MADV_DONTNEED);
+  }
+
+  while (atomic_test_and_set(&stack_cache_lock)) {}
+  list = sthread_stack_cache_list(size);
+  if (list == NULL || list->count >= STACK_CACHE_MAX) {
+    atomic_clear(&stack_cache_lock);
+    munmap(stackbase - guard, guard + size);
+    return;
+  }
+
+  *sthread_stack_link(stackbase, size) = list->head;
+  list->head = stackbase;
+  list->count++;
+  atomic_clear(&stack_cache_lock);
+}
+
 static void sthread_init_stack(sthread_ctx_t *ctx,
                                sthread_ctx_start_func_t func);
 
-sthread_ctx_t *sthread_new_ctx(sthread_ctx_start_func_t func) {
+sthread_ctx_t *sthread_new_ctx(sthread_ctx_start_func_t func,
+                               size_t stack_size) {
   sthread_ctx_t *ctx;
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
 
   ctx = (sthread_ctx_t*)malloc(sizeof(sthread_ctx_t));
   if (ctx == NULL) {
@@ -46,7 +209,16 @@ sthread_ctx_t *sthread_new_ctx(sthread_ctx_start_func_t func) {
     return NULL;
   }
 
-  ctx->stackbase = (char*)malloc(sthread_stack_size);
+  /* Use the default size if none was given, and round up to whole
+   * pages so that the stack can be mapped and released by page. */
+  if (stack_size == 0)
+    stack_size = sthread_stack_size;
+  if (stack_size < sthread_min_stack_size)
+    stack_size = sthread_min_stack_size;
+  stack_size = (stack_size + page - 1) & ~(page - 1);
+
+  ctx->stacksize = stack_size;
+  ctx->stackbase = sthread_alloc_stack(stack_size);
   if (ctx->stackbase == NULL) {
     free(ctx);
     fprintf(stderr, "Out of memory (sthread_new_ctx)\n");
@@ -61,7 +233,7 @@ sthread_ctx_t *sthread_new_ctx(sthread_ctx_start_func_t func) {
    * i386 code), but I don't think it makes any big difference, except
    * for reducing the size of the stack by 16 bytes.
    */
-  ctx->sp = ctx->stackbase + sthread_stack_size - 16;
+  ctx->sp = ctx->stackbase + stack_size - 16;
 
   sthread_init_stack(ctx, func);
 
@@ -71,7 +243,14 @@ sthread_ctx_t *sthread_new_ctx(sthread_ctx_start_func_t func) {
 /* Initialize a stack as if it had been saved by sthread_switch. */
 static void sthread_init_stack(
     sthread_ctx_t *ctx, sthread_ctx_start_func_t func) {
-  memset(ctx->stackbase, 0, sthread_stack_size);
+  /* First push a fake return address for the starting function, which
+   * never returns. The ABI expects the stack pointer to be 16-byte
+   * aligned at a call instruction, so a function is entered with one
+   * return address below a 16-byte boundary; without this slot, the
+   * thread would start on a misaligned stack, which breaks the SSE code
+   * that compilers emit for aligned stack slots. */
+  ctx->sp -= sizeof(void*);
+  *((void**)ctx->sp) = NULL;
 
   /* Push the address of the thread's starting function onto the stack
    * (decrement the stack pointer, then store the item). This will
@@ -86,8 +265,13 @@ static void sthread_init_stack(
 
   /* Leave room for the values pushed on the stack by the "save" half
    * of _sthread_switch. The amount of room varies between CPUs, so we
-   * get this value from the architecture-specific header file. */
+   * get this value from the architecture-specific header file. Only
+   * this initial frame is zeroed; the rest of the stack is never read
+   * before the thread writes it, so we don't touch it (a recycled stack
+   * may hold garbage from its previous thread). */
   ctx->sp -= STHREAD_CONTEXT_SIZE;
+  memset(ctx->sp, 0, STHREAD_CONTEXT_SIZE);
+  STHREAD_INIT_CONTEXT(ctx->sp);
 }
 
 /* Create a new sthread_ctx_t, but don't initialize it.
@@ -106,13 +290,14 @@ sthread_ctx_t *sthread_new_blank_ctx() {
   /* Put some bogus values in */
   ctx->sp = (char*)0xbeefcafe;
   ctx->stackbase = NULL;
+  ctx->stacksize = 0;
   return ctx;
 }
 
 /* Free resources used by given (not currently running) context. */
 void sthread_free_ctx(sthread_ctx_t *ctx) {
   if (ctx->stackbase) {
-    free(ctx->stackbase);
+    sthread_release_stack(ctx->stackbase, ctx->stacksize);
   }
   ctx->stackbase = (char*)0xdeaddead;
   ctx->sp = (char*)0xdeaddead;
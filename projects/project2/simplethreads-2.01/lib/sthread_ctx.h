@@ -16,8 +16,10 @@
 typedef struct _sthread_ctx {
   // Bottom of the stack
   char *stackbase;
+  // Size of the stack, in bytes.
+  size_t stacksize;
   // Current stackpointer (if thread is not running).
-  // Initialized to stackbase + sthread_stack_size.
+  // Initialized to stackbase + stacksize.
   char *sp;
 } sthread_ctx_t;
 
@@ -26,8 +28,13 @@ typedef void (*sthread_ctx_start_func_t)(void);
 /* Make a new context. Note the sthread_ctx_start_func_t is not
  * the same as the sthread_start_func_t; the former takes no arguments
  * and returns nothing, while the later is takes/returns a void*.
+ * Contexts share a cache of stacks, so once preemption is running,
+ * sthread_new_ctx and sthread_free_ctx must be called with interrupts
+ * disabled. stack_size is rounded up to whole pages; 0 selects the
+ * default size.
  */
-sthread_ctx_t *sthread_new_ctx(sthread_ctx_start_func_t func);
+sthread_ctx_t *sthread_new_ctx(sthread_ctx_start_func_t func,
+                               size_t stack_size);
 
 /* Create a new sthread_ctx_t, but don't initialize it.
  * This new sthread_ctx_t is suitable for use as 'old' in
@@ -0,0 +1,112 @@
+#include <config.h>
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include <sthread.h>
+#include <sthread_deque.h>
+
+/* Number of threads a deque can hold; must be a power of two. */
+#define DEQUE_CAPACITY 1024
+
+/* top and bottom only ever grow; a thread's slot is its index modulo
+ * the capacity. The owner pops at bottom - 1 and thieves steal at top,
+ * so they only race for the last thread, which they settle with a
+ * compare-and-swap on top. top and bottom are kept on separate cache
+ * lines, since thieves write the one and the owner the other. */
+struct _sthread_deque {
+  long top __attribute__((aligned(64)));
+  long bottom __attribute__((aligned(64)));
+  sthread_t slots[DEQUE_CAPACITY];
+};
+
+/* Create a new, empty deque. Asserts against error. */
+sthread_deque_t sthread_new_deque() {
+  sthread_deque_t deque;
+  void *mem;
+
+  // aligned, so that top and bottom really are on separate cache lines
+  if (posix_memalign(&mem, 64, sizeof(struct _sthread_deque)) != 0)
+    mem = NULL;
+  assert(mem != NULL);
+
+  deque = (sthread_deque_t)mem;
+  deque->top = deque->bottom = 0;
+
+  return deque;
+}
+
+/* Destroy the given deque. Asserts that the deque is empty. */
+void sthread_free_deque(sthread_deque_t deque) {
+  assert(deque->top == deque->bottom);
+  free(deque);
+}
+
+int sthread_deque_push(sthread_deque_t deque, sthread_t sth) {
+  long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+  assert(sth != NULL);
+  if (b - t >= DEQUE_CAPACITY)
+    return 0;
+
+  __atomic_store_n(&deque->slots[b & (DEQUE_CAPACITY - 1)], sth,
+                   __ATOMIC_RELAXED);
+  // publish the slot before the new bottom
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+sthread_t sthread_deque_pop(sthread_deque_t deque) {
+  long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+  long t;
+  sthread_t sth;
+
+  // claim the bottom slot before looking at top, so that a thief that
+  // reads the old bottom can't also take it unnoticed
+  __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+  if (t > b) {
+    // empty
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  sth = __atomic_load_n(&deque->slots[b & (DEQUE_CAPACITY - 1)],
+                        __ATOMIC_RELAXED);
+  if (t == b) {
+    // last thread: race the thieves for it
+    if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+      sth = NULL;
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return sth;
+}
+
+sthread_t sthread_deque_steal(sthread_deque_t deque) {
+  long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  long b;
+  sthread_t sth;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+  if (t >= b)
+    return NULL;
+
+  sth = __atomic_load_n(&deque->slots[t & (DEQUE_CAPACITY - 1)],
+                        __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, false,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return NULL;
+  return sth;
+}
+
+int sthread_deque_is_empty(sthread_deque_t deque) {
+  return __atomic_load_n(&deque->top, __ATOMIC_RELAXED) >=
+         __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,42 @@
+/* sthread_deque_t is a work-stealing deque of threads (Chase and Lev,
+ * "Dynamic Circular Work-Stealing Deque", SPAA 2005, with the memory
+ * orderings of Le et al., PPoPP 2013). It has one owner, the only
+ * kernel thread that may push and pop, which works at the bottom end
+ * without taking any lock; any other kernel thread may steal from the
+ * top end. The deque has a fixed capacity, and a push onto a full deque
+ * fails rather than growing it.
+ */
+
+#ifndef STHREAD_DEQUE_H
+#define STHREAD_DEQUE_H
+
+#include <sthread.h>
+
+struct _sthread_deque;
+typedef struct _sthread_deque* sthread_deque_t;
+
+/* Create a new, empty deque. */
+sthread_deque_t sthread_new_deque();
+
+/* Destroy the given deque. Asserts that the deque is empty. */
+void sthread_free_deque(sthread_deque_t deque);
+
+/* Owner only: add the given thread at the bottom of the deque. Returns
+ * false, leaving the deque unchanged, if it is full. */
+int sthread_deque_push(sthread_deque_t deque, sthread_t sth);
+
+/* Owner only: return, and remove, the thread at the bottom of the deque
+ * (the one most recently pushed), or NULL if the deque is empty. */
+sthread_t sthread_deque_pop(sthread_deque_t deque);
+
+/* Return, and remove, the thread at the top of the deque (the one
+ * pushed longest ago), or NULL if the deque is empty or another kernel
+ * thread took that thread first. */
+sthread_t sthread_deque_steal(sthread_deque_t deque);
+
+/* Return true if the deque looks empty. Without the owner's cooperation
+ * this is only a hint, since threads may be pushed or stolen at any
+ * time. */
+int sthread_deque_is_empty(sthread_deque_t deque);
+
+#endif /* STHREAD_DEQUE_H */
@@ -0,0 +1,342 @@
+/* Simplethreads Instructional Thread Package
+ *
+ * sthread_io.c - I/O for user-level threads, parking a thread whose I/O
+ *                would block rather than its carrier (see sthread_io.h).
+ */
+
+#include <config.h>
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1   // for accept4
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+
+#include <sthread.h>
+#include <sthread_preempt.h>
+#include <sthread_user.h>
+#include <sthread_io.h>
+
+/* Most events taken from epoll by one sthread_io_poll. */
+#define POLL_EVENTS 64
+
+/* File descriptors are looked up in a table of FD_CHUNKS chunks of
+ * FD_CHUNK_SIZE records, each chunk allocated on first use. */
+#define FD_CHUNK_SIZE 1024
+#define FD_CHUNKS 1024
+
+/* A thread parked on a file descriptor; lives on that thread's stack. */
+typedef struct sthread_io_waiter {
+  sthread_t thread;
+  struct sthread_io_waiter *next;
+} sthread_io_waiter_t;
+
+/* The threads parked on one file descriptor, which is registered with
+ * epoll for the union of what they wait for. A parking thread holds the
+ * spinlock until it has switched away, and whoever wakes it takes the
+ * spinlock first, so that it can't be made ready before it has gone (as
+ * with a mutex's queue). Records are never freed, since the descriptor
+ * number will be reused. */
+typedef struct {
+  lock_t lock;
+  sthread_io_waiter_t *readers;   // waiting for EPOLLIN
+  sthread_io_waiter_t *writers;   // waiting for EPOLLOUT
+  int nonblock_calls;   // calls running with O_NONBLOCK set for them
+  int saved_flags;      // the flags to put back once they are done
+} sthread_io_fd_t;
+
+static sthread_io_fd_t *fd_table[FD_CHUNKS];
+static int epoll_fd = -1;
+static int kick_fd = -1;   // eventfd that wakes carriers sleeping in epoll
+static int waiters = 0;    // threads parked on file descriptors
+static int sleepers = 0;   // carriers sleeping in sthread_io_poll
+
+void sthread_io_init(void) {
+  struct epoll_event ev;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_fd == -1 || kick_fd == -1) {
+    perror("sthread_io_init: epoll_create1/eventfd failed");
+    abort();
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.u64 = 0;
+  ev.data.fd = kick_fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, kick_fd, &ev) != 0) {
+    perror("sthread_io_init: epoll_ctl failed");
+    abort();
+  }
+}
+
+/* The record for fd, or NULL if fd is out of range or out of memory. */
+static sthread_io_fd_t *sthread_io_fd(int fd) {
+  sthread_io_fd_t *chunk, *expected = NULL;
+
+  if (fd < 0 || fd >= FD_CHUNKS * FD_CHUNK_SIZE)
+    return NULL;
+  chunk = __atomic_load_n(&fd_table[fd / FD_CHUNK_SIZE], __ATOMIC_ACQUIRE);
+  if (chunk == NULL) {
+    chunk = calloc(FD_CHUNK_SIZE, sizeof(sthread_io_fd_t));
+    if (chunk == NULL)
+      return NULL;
+    if (!__atomic_compare_exchange_n(&fd_table[fd / FD_CHUNK_SIZE],
+                                     &expected, chunk, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      free(chunk);   // another thread got there first
+      chunk = expected;
+    }
+  }
+  return &chunk[fd % FD_CHUNK_SIZE];
+}
+
+/* Register fd with epoll for the events its waiters want, if any. Only
+ * one carrier takes each event, and fd is left disabled until the next
+ * call rearms it. The record's spinlock must be held. */
+static int sthread_io_arm(int fd, sthread_io_fd_t *f) {
+  struct epoll_event ev;
+
+  ev.events = EPOLLONESHOT;
+  if (f->readers != NULL)
+    ev.events |= EPOLLIN;
+  if (f->writers != NULL)
+    ev.events |= EPOLLOUT;
+  if (ev.events == EPOLLONESHOT)
+    return 0;
+  ev.data.u64 = 0;
+  ev.data.fd = fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) != 0 &&
+      (errno != ENOENT || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0))
+    return -1;
+  return 0;
+}
+
+/* Wake the threads on a list taken from a record; returns how many. */
+static int sthread_io_wake_all(sthread_io_waiter_t *w) {
+  sthread_io_waiter_t *next;
+  int woken = 0;
+
+  // w is gone once its thread may run, so read next first.
+  for (; w != NULL; w = next) {
+    next = w->next;
+    sthread_user_wake(w->thread);
+    woken++;
+  }
+  __sync_fetch_and_sub(&waiters, woken);
+  return woken;
+}
+
+int sthread_io_poll(int timeout_ms) {
+  struct epoll_event events[POLL_EVENTS];
+  int i, n, woken = 0;
+
+  if (timeout_ms == 0 && __atomic_load_n(&waiters, __ATOMIC_RELAXED) == 0)
+    return 0;
+
+  if (timeout_ms != 0)
+    __sync_fetch_and_add(&sleepers, 1);
+  n = epoll_wait(epoll_fd, events, POLL_EVENTS, timeout_ms);
+  if (timeout_ms != 0)
+    __sync_fetch_and_sub(&sleepers, 1);
+
+  for (i = 0; i < n; i++) {
+    int fd = events[i].data.fd;
+    uint32_t fired = events[i].events;
+    sthread_io_waiter_t *readers = NULL, *writers = NULL;
+    sthread_io_fd_t *f;
+
+    if (fd == kick_fd) {
+      uint64_t count;
+      if (read(kick_fd, &count, sizeof(count)) < 0) {
+        // another carrier took the kick first
+      }
+      continue;
+    }
+
+    // Once we hold the spinlock the threads parked here have switched
+    // away. An error or hangup wakes everyone, to see it in their retry.
+    f = sthread_io_fd(fd);
+    while (atomic_test_and_set(&f->lock)) {}
+    if (fired & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+      readers = f->readers;
+      f->readers = NULL;
+    }
+    if (fired & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+      writers = f->writers;
+      f->writers = NULL;
+    }
+    if (sthread_io_arm(fd, f) != 0) {
+      // fd can't be waited for any more, so let the rest retry too
+      woken += sthread_io_wake_all(f->readers) +
+               sthread_io_wake_all(f->writers);
+      f->readers = f->writers = NULL;
+    }
+    atomic_clear(&f->lock);
+
+    woken += sthread_io_wake_all(readers) + sthread_io_wake_all(writers);
+  }
+  return woken;
+}
+
+int sthread_io_has_waiters(void) {
+  return __atomic_load_n(&waiters, __ATOMIC_RELAXED) > 0;
+}
+
+void sthread_io_kick(void) {
+  uint64_t one = 1;
+
+  if (__atomic_load_n(&sleepers, __ATOMIC_RELAXED) == 0)
+    return;
+  if (write(kick_fd, &one, sizeof(one)) < 0) {
+    // the counter is already nonzero, so a kick is already pending
+  }
+}
+
+/* Put fd in nonblocking mode, for good. */
+static void sthread_io_set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+
+  if (flags != -1 && !(flags & O_NONBLOCK))
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Read or write fd, which isn't a socket, without blocking. O_NONBLOCK
+ * is set only for the duration of the call, so that other processes
+ * sharing fd (a shell sharing a terminal, say) find it as they left it.
+ * Calls overlapping on several carriers share the change, and the last
+ * to finish undoes it. */
+static ssize_t sthread_io_rw_nonblocking(int fd, void *buf, size_t count,
+                                         bool writing) {
+  sthread_io_fd_t *f = sthread_io_fd(fd);
+  ssize_t ret;
+  int old, err;
+
+  if (f == NULL)
+    return writing ? write(fd, buf, count) : read(fd, buf, count);
+
+  old = splx(HIGH);
+  while (atomic_test_and_set(&f->lock)) {}
+  if (f->nonblock_calls++ == 0) {
+    f->saved_flags = fcntl(fd, F_GETFL);
+    if (f->saved_flags != -1 && !(f->saved_flags & O_NONBLOCK))
+      fcntl(fd, F_SETFL, f->saved_flags | O_NONBLOCK);
+  }
+  atomic_clear(&f->lock);
+  splx(old);
+
+  ret = writing ? write(fd, buf, count) : read(fd, buf, count);
+  err = errno;
+
+  old = splx(HIGH);
+  while (atomic_test_and_set(&f->lock)) {}
+  if (--f->nonblock_calls == 0 && f->saved_flags != -1 &&
+      !(f->saved_flags & O_NONBLOCK))
+    fcntl(fd, F_SETFL, f->saved_flags);
+  atomic_clear(&f->lock);
+  splx(old);
+
+  errno = err;
+  return ret;
+}
+
+/* Park the calling thread until fd is ready for events (EPOLLIN or
+ * EPOLLOUT), or has an error or hangup. Any number of threads may wait
+ * on fd, for either event. Returns at once if epoll can't wait for fd,
+ * so that the caller's retry reports the error. */
+static void sthread_io_wait(int fd, uint32_t events) {
+  sthread_io_fd_t *f = sthread_io_fd(fd);
+  sthread_io_waiter_t w, **list;
+
+  if (f == NULL)
+    return;
+  list = (events == EPOLLIN) ? &f->readers : &f->writers;
+
+  int old = splx(HIGH);
+  w.thread = sthread_user_running();
+  while (atomic_test_and_set(&f->lock)) {}
+  w.next = *list;
+  *list = &w;
+  __sync_fetch_and_add(&waiters, 1);
+  if (sthread_io_arm(fd, f) != 0) {
+    // Nor can anyone else parked here wait any more.
+    *list = w.next;
+    __sync_fetch_and_sub(&waiters, 1);
+    sthread_io_wake_all(f->readers);
+    sthread_io_wake_all(f->writers);
+    f->readers = f->writers = NULL;
+    atomic_clear(&f->lock);
+    splx(old);
+    return;
+  }
+
+  sthread_user_park(&f->lock);
+  splx(old);
+}
+
+static int sthread_io_would_block(void) {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+/* Sockets are read and written with MSG_DONTWAIT, leaving their flags
+ * alone. Anything else (a pipe or terminal, say) is put in nonblocking
+ * mode just for the call. */
+ssize_t sthread_user_read(int fd, void *buf, size_t count) {
+  ssize_t ret;
+
+  for (;;) {
+    ret = recv(fd, buf, count, MSG_DONTWAIT);
+    if (ret == -1 && errno == ENOTSOCK)
+      ret = sthread_io_rw_nonblocking(fd, buf, count, false);
+    if (ret != -1 || !sthread_io_would_block())
+      return ret;
+    sthread_io_wait(fd, EPOLLIN);
+  }
+}
+
+ssize_t sthread_user_write(int fd, const void *buf, size_t count) {
+  ssize_t ret;
+
+  for (;;) {
+    ret = send(fd, buf, count, MSG_DONTWAIT);
+    if (ret == -1 && errno == ENOTSOCK)
+      ret = sthread_io_rw_nonblocking(fd, (void *)buf, count, true);
+    if (ret != -1 || !sthread_io_would_block())
+      return ret;
+    sthread_io_wait(fd, EPOLLOUT);
+  }
+}
+
+/* The listening socket is put in nonblocking mode, since another thread
+ * may take the connection between a poll and the accept. Accepted
+ * sockets are made nonblocking from the start. */
+int sthread_user_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+  int ret;
+
+  sthread_io_set_nonblocking(fd);
+  while ((ret = accept4(fd, addr, addrlen, SOCK_NONBLOCK)) == -1 &&
+         sthread_io_would_block())
+    sthread_io_wait(fd, EPOLLIN);
+  return ret;
+}
+
+/* sendfile has no MSG_DONTWAIT, so out_fd is put in nonblocking mode
+ * (a socket from sthread_user_accept already is). */
+ssize_t sthread_user_sendfile(int out_fd, int in_fd, off_t *offset,
+                              size_t count) {
+  ssize_t ret;
+
+  sthread_io_set_nonblocking(out_fd);
+  while ((ret = sendfile(out_fd, in_fd, offset, count)) == -1 &&
+         sthread_io_would_block())
+    sthread_io_wait(out_fd, EPOLLOUT);
+  return ret;
+}
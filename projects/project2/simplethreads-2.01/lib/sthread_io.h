@@ -0,0 +1,43 @@
+/*
+ * sthread_io.h - I/O for user-level threads. The routines called by
+ *                applications are described in the sthread.h file.
+ *
+ * A user-level thread that made a blocking system call would block its
+ * carrier, and every thread waiting to run there. These wrappers make
+ * the call without blocking instead (see sthread_io.c for how), and when
+ * it would block, park the calling thread until epoll reports the file
+ * descriptor ready. Idle carriers wait in epoll, and running carriers
+ * check it every so often, to wake the parked threads. Any number of
+ * threads may wait on a file descriptor, some to read and some to write.
+ */
+
+#ifndef STHREAD_IO_H
+#define STHREAD_IO_H 1
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/* Create the epoll instance. Called by sthread_user_init. */
+void sthread_io_init(void);
+
+/* Wake the threads whose file descriptors have become ready, waiting up
+ * to timeout_ms milliseconds for one to (0 returns at once). A sleeping
+ * carrier is also woken early by sthread_io_kick. Returns the number of
+ * threads woken, which are made ready on the calling carrier.
+ * Interrupts must be disabled. */
+int sthread_io_poll(int timeout_ms);
+
+/* Returns nonzero if any thread is parked on a file descriptor. */
+int sthread_io_has_waiters(void);
+
+/* Wake the carriers sleeping in sthread_io_poll, if any, so that they
+ * look for ready threads again. Cheap when none are sleeping. */
+void sthread_io_kick(void);
+
+ssize_t sthread_user_read(int fd, void *buf, size_t count);
+ssize_t sthread_user_write(int fd, const void *buf, size_t count);
+int sthread_user_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+ssize_t sthread_user_sendfile(int out_fd, int in_fd, off_t *offset,
+                              size_t count);
+
+#endif /* STHREAD_IO_H */
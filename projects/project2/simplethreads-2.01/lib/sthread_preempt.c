@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ucontext.h>
 #include "sthread_preempt.h"
 #include "sthread_ctx.h"
@@ -19,16 +20,20 @@
 
 #include <sys/time.h>
 #include <sys/timeb.h>
+#include <sys/syscall.h>
+#include <pthread.h>
 #include <signal.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
 
-// #define ITIMER_REAL ITIMER_VIRTUAL
-// #define SIGALRM SIGVTALRM
-// #define ITIMER_REAL ITIMER_PROF
-// #define SIGALRM SIGPROF
+/* Older C libraries don't name the thread id field of struct sigevent. */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 
 #define LOCK_UNLOCKED 0
 #define LOCK_LOCKED 1
@@ -36,26 +41,61 @@
 int good_interrupts = 0;
 int handled_interrupts = 0;
 int dropped_interrupts = 0;
+int outside_interrupts = 0;
+int deferred_interrupts = 0;
+int timer_arms = 0;
+int timer_disarms = 0;
 
 int inited = false;
 
 void timer_tick64(int signo, siginfo_t *siginfo, void *context);
 void vtimer_tick(int signo, siginfo_t *siginfo, void *context);
 void vtimer_reset(void);
+void sthread_timer_reset(void);
 
 /* defined in the start.c and end.c files respectively */
 extern void proc_start();
 extern void proc_end();
 
 static sthread_ctx_start_func_t interruptHandler;
-static int sthread_interrupts_enabled;
-static struct itimerval sthread_period; // stores timer period
+
+/* Interrupts are disabled with a plain flag rather than by touching the
+ * timer, so splx costs no system calls. A tick that arrives while the
+ * flag says interrupts are off only sets sthread_interrupt_pending, and
+ * splx(LOW) takes the interrupt when they come back on.
+ *
+ * The user-level threads may run on several kernel threads (carriers),
+ * so everything here is kept per carrier: each carrier has its own
+ * preemption timer and watchdog, POSIX timers on its own CPU-time clock
+ * that signal that carrier alone (SIGEV_THREAD_ID). A quantum is thus
+ * CPU time actually used by the running thread, rather than wall-clock
+ * time that may have been spent blocked in the kernel, and every carrier
+ * is preempted independently. The kernel checks CPU-time timers at its
+ * scheduler tick, so a quantum shorter than that is rounded up to it. */
+static __thread volatile sig_atomic_t sthread_interrupts_enabled;
+static __thread volatile sig_atomic_t sthread_interrupt_pending;
+static __thread int sthread_timer_created;   // this carrier has its timers
+static __thread timer_t sthread_timer;       // preemption timer
+static __thread timer_t sthread_watchdog;    // watchdog timer
+// period the preemption timer runs with, in usec; 0 while disarmed
+static __thread int sthread_timer_period;
+static __thread struct itimerspec sthread_period; // stores timer period
+static __thread int sthread_watchdog_sleep;  // if 0, wd resets the timer
+
+/* What to do with a tick that arrives outside our code; see
+ * sthread_preempt.h. */
+static sthread_preempt_mode_t sthread_preempt_mode = STHREAD_PREEMPT_DEFER;
 static const int WD_PERIOD = 500000; // watchdog period in usec.
-static int sthread_watchdog_sleep;           // if 0, wd resets itimer_real
 
 void sthread_print_stats() {
   printf("\ngood interrupts: %d\n", good_interrupts);
   printf("dropped interrupts: %d\n", dropped_interrupts);
+  printf("interrupts outside sthread code, deferred: %d\n",
+         outside_interrupts);
+  printf("deferred interrupts taken: %d\n", deferred_interrupts);
+  printf("timer armed %d times, disarmed %d times\n", timer_arms,
+         timer_disarms);
+  sthread_user_print_stats();
 
   /* handled_interrupts is tracked, but not printed here. In general, the
    * handled_interrupts count is expected to be a few less than the
@@ -94,45 +134,65 @@ void sthread_init_stats() {
 
 void debug_print_timer_val(const char *name) {
   int ret;
-  struct itimerval it;
+  struct itimerspec it;
 
-  ret = getitimer(ITIMER_REAL, &it);
+  ret = timer_gettime(sthread_timer, &it);
   if (ret != 0) {
-    perror("getitimer(ITIMER_REAL) failed");
+    perror("timer_gettime() failed");
+    abort();
+  }
+  fprintf(stderr, "TIMER %s:\n\tinterval sec=%ld, nsec=%ld\n\tvalue sec=%ld, "
+          "nsec=%ld\n", name, it.it_interval.tv_sec, it.it_interval.tv_nsec,
+          it.it_value.tv_sec, it.it_value.tv_nsec);
+}
+
+/* Creates a timer on the calling kernel thread's CPU-time clock that
+ * sends signo to that thread alone. */
+static timer_t sthread_create_timer(int signo) {
+  struct sigevent sev;
+  timer_t timer;
+
+  memset(&sev, 0, sizeof(sev));
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = signo;
+  sev.sigev_notify_thread_id = syscall(SYS_gettid);
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timer) != 0) {
+    perror("timer_create() failed");
     abort();
   }
-  fprintf(stderr, "TIMER %s:\n\tinterval sec=%ld, usec=%ld\n\tvalue sec=%ld, "
-          "usec=%ld\n", name, it.it_interval.tv_sec, it.it_interval.tv_usec,
-          it.it_value.tv_sec, it.it_value.tv_usec);
+  return timer;
 }
 
-/* Sets the timer value to the value saved in sthread_period, or, if it is 0,
- * then to the full interval. This function only makes sense after
- * sthread_timer_init() has first been called.
+/* Sets the period of sthread_period to the given number of usec. */
+static void sthread_set_period(int period) {
+  sthread_period.it_value.tv_sec = period/1000000;
+  sthread_period.it_value.tv_nsec = (period%1000000) * 1000;
+  sthread_period.it_interval.tv_sec = period/1000000;
+  sthread_period.it_interval.tv_nsec = (period%1000000) * 1000;
+}
+
+/* Sets the calling carrier's preemption timer to the value saved in
+ * sthread_period, or, if it is 0, then to the full interval. This
+ * function only makes sense after sthread_preemption_init_carrier() has
+ * first been called.
  *
- * According to setitimer(2), it seems like this function should be
- * unnecessary - if the itimer interval is set to non-zero, then the itimer
- * is supposed to reset infinitely as far as I can tell. However, I found
- * this to not be the case when the preemption period is set to a very small
- * value, which may cause SIGALRMs to be received repeatedly, e.g. while
- * the previous SIGALRM is still being handled or before interrupts can be
- * disabled or whatnot. Calling this function periodically seems to avoid
- * this problem. */
+ * (The process-wide ITIMER_REAL used before had to be reset periodically
+ * when the preemption period was very small, or it could stop firing;
+ * the watchdog still resets the timer if ticks stop coming.) */
 void sthread_timer_reset(void) {
   int ret;
 
   // Check that value isn't 0.  If it is, then do a full reset.  This
-  // situation occurs when the interval timer was turned off in
-  // timer_tick64() or if the interval timer wasn't properly reset.
+  // situation occurs if the interval timer wasn't properly reset.
   if (sthread_period.it_value.tv_sec == 0 &&
-      sthread_period.it_value.tv_usec == 0) {
+      sthread_period.it_value.tv_nsec == 0) {
     sthread_period.it_value.tv_sec = sthread_period.it_interval.tv_sec;
-    sthread_period.it_value.tv_usec = sthread_period.it_interval.tv_usec;
+    sthread_period.it_value.tv_nsec = sthread_period.it_interval.tv_nsec;
   }
 
-  ret = setitimer(ITIMER_REAL, &sthread_period, NULL);
+  ret = timer_settime(sthread_timer, 0, &sthread_period, NULL);
   if (ret != 0) {
-    perror("setitimer(ITIMER_REAL) failed");
+    perror("timer_settime() failed");
     abort();
   }
 }
@@ -140,15 +200,15 @@ void sthread_timer_reset(void) {
 // See comments for sthread_timer_reset
 void vtimer_reset(void) {
   int ret;
-  struct itimerval it;
+  struct itimerspec it;
 
   it.it_interval.tv_sec = 0;
-  it.it_interval.tv_usec = WD_PERIOD;
+  it.it_interval.tv_nsec = WD_PERIOD * 1000;
   it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = WD_PERIOD;
-  ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
+  it.it_value.tv_nsec = WD_PERIOD * 1000;
+  ret = timer_settime(sthread_watchdog, 0, &it, NULL);
   if (ret != 0) {
-    perror("setitimer(ITIMER_VIRTUAL) failed");
+    perror("timer_settime() failed");
     abort();
   }
   return;
@@ -164,15 +224,9 @@ void sthread_timer_init(sthread_ctx_start_func_t func, int period) {
   sthread_init_stats();
   interruptHandler = func;
 
-  // interrupts are initially off
-  sthread_interrupts_enabled = 0;
-  sthread_watchdog_sleep = 0;
-
-  // Save these values
-  sthread_period.it_value.tv_sec = period/1000000;
-  sthread_period.it_value.tv_usec = period%1000000;
-  sthread_period.it_interval.tv_sec = period/1000000;
-  sthread_period.it_interval.tv_usec = period%1000000;
+  const char *mode = getenv("STHREAD_PREEMPT_MODE");
+  if (mode != NULL && strcmp(mode, "drop") == 0)
+    sthread_preempt_mode = STHREAD_PREEMPT_DROP;
 
   // Set up initial signal handler to just ignore SIGALRM.  This is needed in
   // case the signal fires before splx(LOW) has been called at the end of
@@ -189,12 +243,10 @@ void sthread_timer_init(sthread_ctx_start_func_t func, int period) {
     perror("sigaction(SIGALRM) failed");
     abort();
   }
-  // 2) Start the interval timer
-  sthread_timer_reset();
 
-  // We'll use the virtual interval timer as a watchdog aganst anything funny
-  // happening with the real (wall time) timer.
-  // 1) Register a signal handler
+  // We'll use a second CPU-time timer as a watchdog aganst anything funny
+  // happening with the preemption timer.
+  // 2) Register a signal handler
   virt_sa.sa_flags = SA_SIGINFO|SA_RESTART;
   virt_sa.sa_sigaction = vtimer_tick;
   sigemptyset(&virt_mask);
@@ -205,11 +257,34 @@ void sthread_timer_init(sthread_ctx_start_func_t func, int period) {
     perror("sigaction(SIGVTALRM) failed");
     abort();
   }
-  // 2) Activate the virtual timer to fire every 100ms
+
+  // 3) Create this carrier's timers, and start the interval timer
+  sthread_preemption_init_carrier();
+  sthread_set_period(period);
+  sthread_timer_reset();
+  sthread_timer_period = period;
+}
+
+void sthread_preemption_init_carrier(void) {
+#ifndef DISABLE_PREEMPTION
+  // interrupts are initially off
+  sthread_interrupts_enabled = 0;
+  sthread_watchdog_sleep = 0;
+
+  sthread_timer = sthread_create_timer(SIGALRM);
+  sthread_watchdog = sthread_create_timer(SIGVTALRM);
+  sthread_timer_created = 1;
+  // Activate the watchdog timer to fire every WD_PERIOD usec of CPU time
   vtimer_reset();
+#endif
 }
 
 void vtimer_tick(int signo, siginfo_t *siginfo, void *context) {
+  // While the timer is disarmed there is no other thread to run, so
+  // interrupts being off holds nothing up, and there is nothing to watch.
+  if (sthread_timer_period == 0)
+    sthread_watchdog_sleep = 1;
+
   if (sthread_watchdog_sleep) {
     sthread_watchdog_sleep = 0; // wake up next time if not reset
   } else {
@@ -223,30 +298,51 @@ void vtimer_tick(int signo, siginfo_t *siginfo, void *context) {
             );
     // Force a full reset
     sthread_period.it_value.tv_sec = sthread_period.it_interval.tv_sec;
-    sthread_period.it_value.tv_sec = sthread_period.it_interval.tv_usec;
+    sthread_period.it_value.tv_nsec = sthread_period.it_interval.tv_nsec;
     sthread_timer_reset();
   }
 }
 
+void sthread_preemption_arm(int period) {
+  if (!sthread_timer_created || period == sthread_timer_period)
+    return;
+
+  sthread_set_period(period);
+  sthread_timer_reset();
+  sthread_timer_period = period;
+  timer_arms++;
+}
+
+void sthread_preemption_disarm(void) {
+  struct itimerspec off;
+
+  if (!sthread_timer_created || sthread_timer_period == 0)
+    return;
+
+  memset(&off, 0, sizeof(off));
+  if (timer_settime(sthread_timer, 0, &off, NULL) != 0) {
+    perror("timer_settime() failed");
+    abort();
+  }
+  sthread_timer_period = 0;
+  timer_disarms++;
+}
+
 #ifdef STHREAD_CPU_X86_64
 void timer_tick64(int signo, siginfo_t *siginfo, void *context) {
   int ret;
   sigset_t mask;
 
-  // Put the watchdog timer back to sleep
-  sthread_watchdog_sleep = 1;
-
   if (!sthread_interrupts_enabled) {
-    // Turn off the timer
-    struct itimerval it;
-    it.it_interval.tv_sec = 0;
-    it.it_interval.tv_usec = 0;
-    it.it_value.tv_sec = 0;
-    it.it_value.tv_usec = 0;
-    setitimer(ITIMER_REAL, &it, NULL);
+    // Leave the interrupt for splx(LOW) to take. The watchdog is left
+    // awake, so that it still notices interrupts being off for too long.
+    sthread_interrupt_pending = 1;
     return;
   }
 
+  // Put the watchdog timer back to sleep
+  sthread_watchdog_sleep = 1;
+
   /* See sigaction(2). ucontext_t is defined in /usr/include/sys/ucontext.h.
    * This code was inspired by
    * http://stackoverflow.com/questions/5397041/getting-the-saved-instruction-pointer-address-from-a-signal-handler.  NOLINT
@@ -265,6 +361,7 @@ void timer_tick64(int signo, siginfo_t *siginfo, void *context) {
       !(ip >= (uint64_t) Xsthread_switch &&
         ip < (uint64_t) Xsthread_switch_end)) {
     good_interrupts++;
+    sthread_interrupt_pending = 0;
 
 #ifdef DEBUG_PREEMPT
     sthread_print_stats();
@@ -304,6 +401,14 @@ void timer_tick64(int signo, siginfo_t *siginfo, void *context) {
     }
     interruptHandler();
     handled_interrupts++;
+  } else if (sthread_preempt_mode == STHREAD_PREEMPT_DEFER) {
+    /* We were interrupted in code where we can't switch threads, most
+     * often a libc function such as memset, printf or write. Rather than
+     * lose the tick, and let a thread that spends its time in libc keep
+     * the CPU until a tick happens to land in our code, leave it pending:
+     * the next splx(LOW), which every sthread call makes, takes it. */
+    outside_interrupts++;
+    sthread_interrupt_pending = 1;
   } else {
     /* PJH: I ran test-preempt with a tiny preemption interval and printed
      * out the ip here, then used gdb to check what functions tend to be
@@ -374,7 +479,6 @@ void debug_print_sigaction(struct sigaction *sa, const char *name) {
  * HIGH = interrupts OFF
  */
 int splx(int splval) {
-  struct itimerval it;
   int ret = sthread_interrupts_enabled;
 
   if (!inited) {
@@ -383,25 +487,28 @@ int splx(int splval) {
   }
 
   if (splval == HIGH) {
-    // Turn off interrupts.
-    // First save the currentf value on the timer so that when interrupts
-    // are turned back on, this time is used.  Then, flag that they should
-    // be disabled next time SIGALRM is delivered.
-    getitimer(ITIMER_REAL, &it);
-    sthread_period.it_value.tv_sec = it.it_value.tv_sec;
-    sthread_period.it_value.tv_usec = it.it_value.tv_usec;
+    // Turn off interrupts. The timer keeps running; a tick that arrives
+    // now is left pending.
     sthread_interrupts_enabled = 0;
   } else {
-    // Turn on interrupts.
-    // Set the enabled flag high and reset the timer.  Reset here will use
-    // the values saved above so that no thread can hog all the time by
-    // abusing functions that use splx internally.
+    // Turn on interrupts, and take any interrupt that arrived while they
+    // were off. The handler clears the pending flag if it interrupts us
+    // between these two steps, so the interrupt is taken only once.
     sthread_interrupts_enabled = 1;
-    sthread_timer_reset();
+    if (sthread_interrupt_pending) {
+      sthread_interrupt_pending = 0;
+      sthread_watchdog_sleep = 1;
+      deferred_interrupts++;
+      interruptHandler();
+    }
   }
   return ret;
 }
 
+void sthread_preemption_set_mode(sthread_preempt_mode_t mode) {
+  sthread_preempt_mode = mode;
+}
+
 /* start preemption - func will be called every period microseconds */
 void sthread_preemption_init(sthread_ctx_start_func_t func, int period) {
 #ifndef DISABLE_PREEMPTION
@@ -14,13 +14,49 @@
 typedef uint32_t lock_t;
 
 
-/* start preemption - func will be called every period microseconds */
+/* start preemption - func will be called every period microseconds of
+ * the calling carrier's CPU time */
 void sthread_preemption_init(sthread_ctx_start_func_t func, int period);
 
+/* The timer only needs to run while there is another thread to switch
+ * to. sthread_preemption_arm starts it, if needed, to call func every
+ * period microseconds; sthread_preemption_disarm stops it. Both are
+ * cheap when the timer is already in the state asked for, and act on
+ * the calling carrier's timer only. Interrupts must be disabled.
+ */
+void sthread_preemption_arm(int period);
+void sthread_preemption_disarm(void);
+
+/* What to do with a timer tick that interrupts code outside the sthread
+ * library and application (libc, say), where it isn't safe to switch
+ * threads. STHREAD_PREEMPT_DROP ignores it, as simplethreads always
+ * did. STHREAD_PREEMPT_DEFER, the default, leaves it pending and
+ * preempts at the next splx(LOW), that is, at the next sthread call,
+ * which bounds how long a thread that lives in libc keeps the CPU.
+ * Setting STHREAD_PREEMPT_MODE=drop in the environment selects
+ * STHREAD_PREEMPT_DROP.
+ */
+typedef enum {
+  STHREAD_PREEMPT_DROP,
+  STHREAD_PREEMPT_DEFER
+} sthread_preempt_mode_t;
+
+void sthread_preemption_set_mode(sthread_preempt_mode_t mode);
+
+/* Gives the calling kernel thread (a carrier) its own preemption timer
+ * and watchdog, which run on its CPU time, after sthread_preemption_init
+ * has been called on another carrier. The preemption timer is left
+ * disarmed, and interrupts off.
+ */
+void sthread_preemption_init_carrier(void);
+
 /* Turns inturrupts ON and off 
  * Returns the last state of the inturrupts
  * LOW = inturrupts ON
  * HIGH = inturrupts OFF
+ * This only sets a flag, so it is cheap enough to bracket every short
+ * critical section. An interrupt that arrives while interrupts are off
+ * is taken when they are turned back on.
  */
 int splx(int splval);
 
@@ -41,8 +77,12 @@ void atomic_clear(lock_t *l);
 
 
 /*
- * sthread_print_stats - prints out the number of drupped interrupts
- *   and "successful" interrupts
+ * sthread_print_stats - prints out the number of drupped interrupts,
+ *   "successful" interrupts and deferred interrupts (arriving while
+ *   interrupts were off or outside our code, and taken later at
+ *   splx(LOW)), how often the timer was armed and disarmed, and where
+ *   each carrier found the threads it ran (its own deque or yield
+ *   queue, or other carriers)
  */
 void sthread_print_stats();
 
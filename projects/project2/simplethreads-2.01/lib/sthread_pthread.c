@@ -13,6 +13,7 @@
 
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/sendfile.h>
 
 #if defined(HAVE_SCHED_H)
 #include <sched.h>
@@ -27,9 +28,11 @@
 #ifdef HAVE_PTHREAD_H
 #include <pthread.h>
 #endif
+#include <limits.h>
 #include <stdio.h>
 
 #include <sthread.h>
+#include <sthread_pthread.h>
 
 struct _sthread {
   pthread_t pth;
@@ -44,17 +47,64 @@ void sthread_pthread_init(void) {
   /* pthreads don't need to be initialized explicitly */
 }
 
+void sthread_pthread_set_concurrency(int ncarriers) {
+  /* Every sthread is a kernel thread already; this is only a hint. */
+  pthread_setconcurrency(ncarriers);
+}
+
+void sthread_pthread_set_quantum(int priority, int usec) {
+  /* The kernel decides how long a kernel thread runs. */
+}
+
 sthread_t sthread_pthread_create(
     sthread_start_func_t start_routine, void *arg, int joinable) {
+  sthread_attr_t attr;
+  sthread_attr_init(&attr);
+  attr.detached = !joinable;
+  return sthread_pthread_create_attr(start_routine, arg, &attr);
+}
+
+sthread_t sthread_pthread_create_attr(
+    sthread_start_func_t start_routine, void *arg,
+    const sthread_attr_t *attr) {
   sthread_t sth;
+  pthread_attr_t pattr;
   int err;
 
   sth = malloc(sizeof(struct _sthread));
+  assert(sth != NULL);
+
+  pthread_attr_init(&pattr);
+  if (attr->stack_size != 0) {
+    size_t stack_size = attr->stack_size;
+    if (stack_size < PTHREAD_STACK_MIN)
+      stack_size = PTHREAD_STACK_MIN;
+    pthread_attr_setstacksize(&pattr, stack_size);
+  }
+  /* A detached thread is created joinable and detached once it has
+   * been named below: a thread created detached may already have exited,
+   * and its pthread_t been reused, by the time we get to name it. */
+  /* The priority hint is ignored: changing the scheduling policy of a
+   * kernel thread needs privileges that we don't expect to have. */
+
+  err = pthread_create(&(sth->pth), &pattr, start_routine, arg);
+  pthread_attr_destroy(&pattr);
+  if (err) {
+    free(sth);
+    return NULL;
+  }
 
-  err = pthread_create(&(sth->pth), NULL, start_routine, arg);
-  if (!err && !joinable) {
-    err = pthread_detach(sth->pth);
+#ifdef HAVE_PTHREAD_SETNAME_NP
+  if (attr->name != NULL) {
+    /* Linux limits thread names to 15 characters. */
+    char name[16];
+    strncpy(name, attr->name, sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    pthread_setname_np(sth->pth, name);
   }
+#endif
+  if (attr->detached)
+    pthread_detach(sth->pth);
 
   return sth;
 }
@@ -162,3 +212,22 @@ void sthread_pthread_cond_wait(sthread_cond_t cond,
                                sthread_mutex_t lock) {
   pthread_cond_wait(&(cond->pcond), &(lock->plock));
 }
+
+/* Kernel threads can simply block. */
+ssize_t sthread_pthread_read(int fd, void *buf, size_t count) {
+  return read(fd, buf, count);
+}
+
+ssize_t sthread_pthread_write(int fd, const void *buf, size_t count) {
+  return write(fd, buf, count);
+}
+
+int sthread_pthread_accept(int fd, struct sockaddr *addr,
+                           socklen_t *addrlen) {
+  return accept(fd, addr, addrlen);
+}
+
+ssize_t sthread_pthread_sendfile(int out_fd, int in_fd, off_t *offset,
+                                 size_t count) {
+  return sendfile(out_fd, in_fd, offset, count);
+}
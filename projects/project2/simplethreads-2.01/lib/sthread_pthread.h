@@ -10,8 +10,13 @@
 #define STHREAD_PTHREAD_H 1
 
 void sthread_pthread_init(void);
+void sthread_pthread_set_concurrency(int ncarriers);
+void sthread_pthread_set_quantum(int priority, int usec);
 sthread_t sthread_pthread_create(
     sthread_start_func_t start_routine, void *arg, int joinable);
+sthread_t sthread_pthread_create_attr(
+    sthread_start_func_t start_routine, void *arg,
+    const sthread_attr_t *attr);
 void sthread_pthread_exit(void *ret);
 void sthread_pthread_yield(void);
 void* sthread_pthread_join(sthread_t t);
@@ -27,4 +32,11 @@ void sthread_pthread_cond_broadcast(sthread_cond_t cond);
 void sthread_pthread_cond_wait(
     sthread_cond_t cond, sthread_mutex_t lock);
 
+ssize_t sthread_pthread_read(int fd, void *buf, size_t count);
+ssize_t sthread_pthread_write(int fd, const void *buf, size_t count);
+int sthread_pthread_accept(int fd, struct sockaddr *addr,
+                           socklen_t *addrlen);
+ssize_t sthread_pthread_sendfile(int out_fd, int in_fd, off_t *offset,
+                                 size_t count);
+
 #endif /* STHREAD_PTHREAD_H */
@@ -1,11 +1,9 @@
 /* Note: sthread_queue_t is not synchronized. If used from multiple
  * threads, it is the users responsibility to provide suitable mutual
- * exclusion. The sthread queue library maintains a global free list
- * from which it allocates links, so even if all queues are freed via
- * sthread_free_queue(), Valgrind will still report memory as "in use
- * at exit". Applications or libraries building on the sthread library
- * may use sthread_queue_clear_free_list() to free the memory associated
- * with this free list prior to exit in order to avoid such reports.
+ * exclusion. Queues are intrusive: a thread is chained into a queue
+ * through the sthread_queue_link_t embedded in its struct _sthread,
+ * so enqueueing and dequeueing never allocate memory, and a thread can
+ * be on at most one queue at a time.
  */
 
 #ifndef STHREAD_QUEUE_H
@@ -16,6 +14,14 @@
 struct _sthread_queue;
 typedef struct _sthread_queue* sthread_queue_t;
 
+/* The link that chains a thread into a queue. An sthread implementation
+ * that uses these queues must make it the first member of its
+ * struct _sthread, so that a thread and its link can be converted
+ * into each other. */
+typedef struct _sthread_queue_link {
+  struct _sthread_queue_link *next;
+} sthread_queue_link_t;
+
 /* Create a new, empty queue */
 sthread_queue_t sthread_new_queue();
 
@@ -35,10 +41,9 @@ int sthread_queue_size(sthread_queue_t queue);
 /* Return true if queue has no threads, false otherwise */
 int sthread_queue_is_empty(sthread_queue_t queue);
 
-/* Clear the global free list associated with the sthread
- * queue library. In order to maintain efficiency of queue
- * insertions, this should be called a single time when
- * the sthread library has no further use for queues. */
+/* Formerly cleared the global free list of queue links. Links are now
+ * embedded in the threads, so there is nothing to free; this is kept
+ * so that existing callers still build. */
 void sthread_queue_clear_free_list(void);
 
 #endif /* STHREAD_QUEUE_H */
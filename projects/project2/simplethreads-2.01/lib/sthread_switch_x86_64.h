@@ -7,11 +7,9 @@
  *   Save the currently running thread's context on its stack, switch to
  *   the new thread by swapping in its stack pointer, then pop that thread's
  *   context off of the stack and return. The state that we store on the
- *   stack includes all of the general-purpose registers; note that we
- *   DON'T store other state that makes up "context" such as the floating-
- *   point registers, MMX registers, and so on. So, this means that this
- *   code may not work (may cause mysterious bugs) for threads in a program
- *   that uses these floating-point / SIMD registers.
+ *   stack is the callee-saved registers and floating-point control state
+ *   (or all of the general-purpose registers, with
+ *   STHREAD_FULL_CONTEXT_SWITCH); see STHREAD_CONTEXT_SIZE below.
  *
  * We put this code in a .S file, instead of using the gcc 'asm (...)' syntax,
  * to make it more robust (this way, the compiler won't change _anything_, and
@@ -50,16 +48,50 @@
 void Xsthread_switch(char **old_sp, char *new_sp);
 void Xsthread_switch_end();
 
-/* This value tells the stack-setup code (sthread_new_ctx(), sthread_init_stack())
- * how much space (in bytes) we need on the stack to store the general-purpose
- * registers that make up a thread's context. On x86_64 architectures, there
- * are 16 64-bit (8-byte) general-purpose registers; however, we don't store
- * the stack pointer register on the stack, because we store it separately in
- * the thread context structures and pass it as an argument to this function.
- * Therefore, we only need room for 15 registers in our stack context (and so
- * there are 15 pushes and 15 pops in the code below).
+/* By default we save only the state that the System V ABI requires a
+ * called function to preserve: the callee-saved registers rbx, rbp and
+ * r12-r15, the SSE control/status register MXCSR and the x87 control
+ * word. Xsthread_switch is only ever reached through an ordinary C call
+ * (sthread_switch()), so the compiler has already saved any caller-saved
+ * registers it still needs. This holds for preemption too: there the
+ * switch is called from the SIGALRM handler, and the kernel has saved
+ * every register of the interrupted code in the signal frame, which
+ * sigreturn restores when the thread is eventually switched back to.
+ *
+ * Defining STHREAD_FULL_CONTEXT_SWITCH (e.g. with
+ * CPPFLAGS=-DSTHREAD_FULL_CONTEXT_SWITCH at configure time) selects the
+ * original switch, which pushes all 15 general-purpose registers, for
+ * debugging.
+ *
+ * STHREAD_CONTEXT_SIZE tells the stack-setup code (sthread_new_ctx(),
+ * sthread_init_stack()) how much space (in bytes) the saved context takes
+ * on the stack. We don't store the stack pointer register on the stack,
+ * because we store it separately in the thread context structures and
+ * pass it as an argument to this function. STHREAD_INIT_CONTEXT(sp)
+ * fills in the initial values of a new thread's saved context, which
+ * sthread_init_stack() has zeroed.
  */
+#ifdef STHREAD_FULL_CONTEXT_SWITCH
+
+/* 15 general-purpose registers (so there are 15 pushes and 15 pops in
+ * the code below). */
 #define STHREAD_CONTEXT_SIZE (15*8)
+#define STHREAD_INIT_CONTEXT(sp) ((void)0)
+
+#else
+
+/* 6 callee-saved registers, plus one 8-byte slot holding MXCSR in its
+ * low 4 bytes and the x87 control word in the next 2. The slot is
+ * lowest on the stack. */
+#define STHREAD_CONTEXT_SIZE (7*8)
+#define STHREAD_INIT_MXCSR 0x1f80  /* all exceptions masked, round to nearest */
+#define STHREAD_INIT_FPUCW 0x037f  /* all exceptions masked, double extended */
+#define STHREAD_INIT_CONTEXT(sp) do {                      \
+    *(uint32_t *)(sp) = STHREAD_INIT_MXCSR;                \
+    *(uint16_t *)((char *)(sp) + 4) = STHREAD_INIT_FPUCW;  \
+  } while (0)
+
+#endif  // STHREAD_FULL_CONTEXT_SWITCH
 
 #else  /* in assembly mode */
 
@@ -70,6 +102,7 @@ void Xsthread_switch_end();
 
     /* in C terms: void Xsthread_switch(char **old_sp, char *new_sp) */
     Xsthread_switch:
+#ifdef STHREAD_FULL_CONTEXT_SWITCH
     /* Push register state onto our current (old) stack. The i386 pusha
      * and popa instructions no longer work in 64-bit mode, so instead
      * we explicitly push all of the general-purpose registers here.
@@ -137,6 +170,40 @@ void Xsthread_switch_end();
     pop %rbx
     pop %rax
 
+#else
+    /* Push the callee-saved registers onto our current (old) stack,
+     * then the floating-point control state, which is also callee-saved
+     * (the caller expects the rounding mode and exception masks it set
+     * to survive the call). The amount of data pushed here (and popped
+     * off later on) must match STHREAD_CONTEXT_SIZE!
+     */
+    push %rbx
+    push %rbp
+    push %r12
+    push %r13
+    push %r14
+    push %r15
+    sub $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+
+    /* Save old stack into memory at *old_sp (rdi), load new stack from
+     * new_sp (rsi). */
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+
+    /* Pop the saved state off the new stack: */
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    add $8, %rsp
+    pop %r15
+    pop %r14
+    pop %r13
+    pop %r12
+    pop %rbp
+    pop %rbx
+#endif  // STHREAD_FULL_CONTEXT_SWITCH
+
     /* Return to whatever PC the current (new) stack tells us to: */
     ret
     Xsthread_switch_end:
@@ -14,37 +14,354 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <sthread.h>
 #include <sthread_queue.h>
+#include <sthread_deque.h>
 #include <sthread_user.h>
 #include <sthread_ctx.h>
 #include <sthread_user.h>
 #include <sthread_preempt.h>
-
-static const int TIMEOUT = 20;
+#include <sthread_io.h>
+
+/* Preemption quantum of normal threads, in usec. The preemption timers
+ * run on CPU time, which the kernel only checks at its scheduler tick
+ * (1 to 4 ms), so a quantum much shorter than that would be rounded up
+ * to the same tick whatever its priority class. */
+static const int TIMEOUT = 4000;
+
+/* Most carriers we will start, whatever is asked for. */
+#define MAX_CARRIERS 64
+
+/* Stack size of the idle loop of carrier 0; the other carriers run
+ * their idle loop on their own pthread stack. */
+#define IDLE_STACK_SIZE (64 * 1024)
+
+/* Number of empty passes an idle carrier makes over the ready queues,
+ * yielding the CPU after each, before it starts to sleep between
+ * passes. It sleeps in sthread_io_poll, so that it wakes as soon as a
+ * parked thread's I/O is ready, or another carrier has work for it. */
+#define IDLE_SPINS 1000
+#define IDLE_SLEEP_MSEC 10
+
+/* Every FAIRNESS_TICK picks, a carrier takes the thread that has waited
+ * longest, from its yield queue or the top of its deque, rather than the
+ * newest one, so that threads that keep waking each other can't starve
+ * the rest. */
+#define FAIRNESS_TICK 61
 
 struct _sthread {
+  sthread_queue_link_t link;  // must be first, see sthread_queue.h
   sthread_ctx_t *saved_ctx;
   int tid;
   sthread_start_func_t start_routine;
   void *start_routine_args;
   void *ret_val;
   bool joinable;
+  lock_t join_lock;  // guards join_caller and has_terminated
   struct _sthread *join_caller;
   bool has_terminated;
+  const char *name;  // from sthread_attr_t, for debugging
+  int priority;      // scheduling hint from sthread_attr_t
 };
 
+/* User threads run on one or more kernel threads, called carriers.
+ * Each carrier has its own running thread and its own ready threads, in
+ * two places: a work-stealing deque, which new and woken threads are
+ * pushed onto and which the carrier pops newest first (the thread most
+ * likely to find its data still in the cache), and a FIFO yield queue,
+ * for threads that have yielded or been preempted and should wait their
+ * turn (and for overflow from a full deque). A carrier that runs out of
+ * ready threads steals the oldest thread from another carrier's deque,
+ * or failing that takes one from its yield queue.
+ *
+ * A thread that blocks can't put itself on a queue and then switch
+ * away, since another carrier could take it off the queue and run it
+ * before its context has been saved. Instead, it leaves the last step
+ * to the thread (or idle loop) it switches to, which does it in
+ * sthread_finish_switch once the switch is complete: it puts the old
+ * thread on the ready queue (yield), releases the spinlock of the queue
+ * the old thread is waiting on (mutex, condition, join), or frees the
+ * stack of the old thread (exit). */
+typedef struct {
+  int id;
+  sthread_t running_thread;      // NULL while the carrier is idle
+  sthread_deque_t deque;         // pushed and popped by this carrier only
+  lock_t yield_lock;             // guards yield_queue
+  sthread_queue_t yield_queue;
+  unsigned int ticks;            // picks made, for FAIRNESS_TICK
+  sthread_ctx_t *idle_ctx;       // where the carrier goes with no work
+  pthread_t pthread;
+
+  // work left for sthread_finish_switch
+  sthread_t switch_ready;        // thread to make ready
+  lock_t *switch_unlock;         // spinlock to release
+  sthread_t switch_dead;         // exited thread to free
+
+  // where this carrier's threads came from, see sthread_print_stats
+  unsigned long local_pops;      // own deque
+  unsigned long yield_pops;      // own yield queue
+  unsigned long steals;          // other carriers
+} __attribute__((aligned(64))) sthread_carrier_t;
+
 static unsigned int tid_counter = 0;
 static bool init_called = false;
-static sthread_t running_thread;
-static sthread_queue_t ready_queue;
-static sthread_queue_t dead_queue;
-static sthread_t dead_thread;
+static int ncarriers = 0;      // 0 until set, then fixed by sthread_init
+static sthread_carrier_t carriers[MAX_CARRIERS];
+static int live_threads = 0;           // threads that haven't exited
+
+/* Preemption quantum, in microseconds, of threads of each priority
+ * class: below normal, normal and above normal (see sthread_set_quantum).
+ */
+static int quantum[3] = { TIMEOUT / 2, TIMEOUT, 2 * TIMEOUT };
+
+static __thread sthread_carrier_t *current_carrier;
+
+/* Returns the carrier that the caller is running on. A user thread may
+ * resume on another carrier after any switch, so this must be called
+ * again after switching rather than cached; it is kept out of line so
+ * that the compiler can't reuse a thread-local address computed before
+ * the switch. */
+static sthread_carrier_t *sthread_carrier(void) __attribute__((noinline));
+static sthread_carrier_t *sthread_carrier(void) {
+  __asm__ __volatile__("");
+  return current_carrier;
+}
+
+static int sthread_priority_class(int priority) {
+  return priority < 0 ? 0 : (priority == 0 ? 1 : 2);
+}
+
+/* Returns true if c has threads ready to run besides its running one. */
+static int sthread_has_ready(sthread_carrier_t *c) {
+  return !sthread_deque_is_empty(c->deque) ||
+         !sthread_queue_is_empty(c->yield_queue);
+}
+
+/* Arm the preemption timer, with the quantum of the running thread, if
+ * c, the caller's own carrier, has another thread to switch to, or a
+ * thread parked on I/O may become one (the tick is what polls for it).
+ * The timer is disarmed by sthread_user_yield, when a tick finds neither,
+ * so a lone thread (or an idle carrier) takes no timer signals. */
+static void sthread_update_timer(sthread_carrier_t *c) {
+  if (c->running_thread != NULL &&
+      (sthread_has_ready(c) || sthread_io_has_waiters())) {
+    int class = sthread_priority_class(c->running_thread->priority);
+    sthread_preemption_arm(quantum[class]);
+  }
+}
+
+/* Put t at the back of c's yield queue. */
+static void sthread_make_yielded(sthread_carrier_t *c, sthread_t t) {
+  while (atomic_test_and_set(&c->yield_lock)) {}
+  sthread_enqueue(c->yield_queue, t);
+  atomic_clear(&c->yield_lock);
+}
+
+/* Make t ready to run on c, which must be the caller's own carrier. */
+static void sthread_make_ready(sthread_carrier_t *c, sthread_t t) {
+  if (!sthread_deque_push(c->deque, t))
+    sthread_make_yielded(c, t);
+  sthread_update_timer(c);
+  sthread_io_kick();
+}
+
+/* Take the thread at the front of c's yield queue, if any. */
+static sthread_t sthread_take_yielded(sthread_carrier_t *c) {
+  sthread_t t;
+
+  if (sthread_queue_is_empty(c->yield_queue))
+    return NULL;
+  while (atomic_test_and_set(&c->yield_lock)) {}
+  t = sthread_dequeue(c->yield_queue);
+  atomic_clear(&c->yield_lock);
+  return t;
+}
+
+/* Take the next thread for c, the caller's own carrier, to run from its
+ * own ready threads, or NULL if it has none. */
+static sthread_t sthread_take_ready(sthread_carrier_t *c) {
+  sthread_t t;
+
+  if (++c->ticks % FAIRNESS_TICK == 0) {
+    if ((t = sthread_take_yielded(c)) != NULL) {
+      c->yield_pops++;
+      return t;
+    }
+    if ((t = sthread_deque_steal(c->deque)) != NULL) {
+      c->local_pops++;
+      return t;
+    }
+  }
+
+  if ((t = sthread_deque_pop(c->deque)) != NULL) {
+    c->local_pops++;
+    return t;
+  }
+  if ((t = sthread_take_yielded(c)) != NULL) {
+    c->yield_pops++;
+    return t;
+  }
+  return NULL;
+}
+
+/* Take a ready thread from some other carrier for c to run, or NULL if
+ * none could be had. */
+static sthread_t sthread_steal_ready(sthread_carrier_t *c) {
+  for (int i = 1; i < ncarriers; i++) {
+    sthread_carrier_t *victim = &carriers[(c->id + i) % ncarriers];
+    sthread_t t = sthread_deque_steal(victim->deque);
+    if (t == NULL)
+      t = sthread_take_yielded(victim);
+    if (t != NULL) {
+      c->steals++;
+      return t;
+    }
+  }
+  return NULL;
+}
+
+void sthread_user_print_stats(void) {
+  for (int i = 0; i < ncarriers; i++) {
+    printf("carrier %d: %lu local pops, %lu yield queue pops, %lu steals\n",
+           i, carriers[i].local_pops, carriers[i].yield_pops,
+           carriers[i].steals);
+  }
+}
+
+/* Finish the switch that brought us onto this carrier; see
+ * sthread_carrier_t. Interrupts must be disabled. */
+static void sthread_finish_switch(void) {
+  sthread_carrier_t *c = sthread_carrier();
+
+  if (c->switch_ready != NULL) {
+    sthread_make_yielded(c, c->switch_ready);
+    c->switch_ready = NULL;
+  }
+  if (c->switch_unlock != NULL) {
+    atomic_clear(c->switch_unlock);
+    c->switch_unlock = NULL;
+  }
+  if (c->switch_dead != NULL) {
+    sthread_t dead = c->switch_dead;
+    c->switch_dead = NULL;
+    sthread_free_ctx(dead->saved_ctx);
+    dead->saved_ctx = NULL;
+    if (!dead->joinable) {
+      free(dead);
+    } else {
+      // Only now may a joiner free the thread, so only now is it marked
+      // terminated; a joiner that came after it exited is woken here.
+      while (atomic_test_and_set(&dead->join_lock)) {}
+      dead->has_terminated = true;
+      sthread_t joiner = dead->join_caller;
+      dead->join_caller = NULL;
+      atomic_clear(&dead->join_lock);
+      if (joiner != NULL)
+        sthread_make_ready(c, joiner);
+    }
+  }
+  sthread_update_timer(c);
+}
+
+/* Switch from the context old to the thread next, or to the carrier's
+ * idle loop if next is NULL, and finish the switch when we are resumed.
+ * Interrupts must be disabled. */
+static void sthread_switch_to(sthread_ctx_t *old, sthread_t next) {
+  sthread_carrier_t *c = sthread_carrier();
+
+  c->running_thread = next;
+  sthread_switch(old, next != NULL ? next->saved_ctx : c->idle_ctx);
+  sthread_finish_switch();
+}
+
+/* The scheduler loop of a carrier with nothing to run: it runs its own
+ * ready threads, and when it has none, steals from the other carriers.
+ * Entered with interrupts disabled. */
+static void sthread_carrier_idle(void) {
+  sthread_carrier_t *c = sthread_carrier();
+  int spins = 0;
+
+  for (;;) {
+    sthread_finish_switch();
+
+    sthread_t next = sthread_take_ready(c);
+    if (next == NULL)
+      next = sthread_steal_ready(c);
+    if (next == NULL && sthread_io_poll(0) > 0)
+      next = sthread_take_ready(c);
+
+    if (next != NULL) {
+      spins = 0;
+      c->running_thread = next;
+      sthread_switch(c->idle_ctx, next->saved_ctx);
+      continue;
+    }
+
+    if (spins < IDLE_SPINS) {
+      // Let any pending tick in while we wait; on an idle carrier
+      // sthread_user_yield only disarms the timer.
+      spins++;
+      splx(LOW);
+      sched_yield();
+      splx(HIGH);
+    } else {
+      sthread_io_poll(IDLE_SLEEP_MSEC);
+    }
+  }
+}
+
+static void *sthread_carrier_main(void *arg) {
+  current_carrier = (sthread_carrier_t *) arg;
+  sthread_preemption_init_carrier();
+  splx(HIGH);
+  sthread_carrier_idle();
+  return NULL;
+}
+
+static void sthread_carrier_init(sthread_carrier_t *c, int id) {
+  c->id = id;
+  c->running_thread = NULL;
+  c->deque = sthread_new_deque();
+  c->yield_lock = 0;
+  c->yield_queue = sthread_new_queue();
+  c->ticks = 0;
+  c->switch_ready = NULL;
+  c->switch_unlock = NULL;
+  c->switch_dead = NULL;
+  c->local_pops = c->yield_pops = c->steals = 0;
+  if (id == 0) {
+    c->idle_ctx = sthread_new_ctx(sthread_carrier_idle, IDLE_STACK_SIZE);
+  } else {
+    c->idle_ctx = sthread_new_blank_ctx();
+  }
+  if (c->yield_queue == NULL || c->idle_ctx == NULL) {
+    printf("Error: cannot create carrier %d.\n", id);
+    exit(EXIT_FAILURE);
+  }
+}
 
 /*********************************************************************/
 /* Part 1: Creating and Scheduling Threads                           */
 /*********************************************************************/
+void sthread_user_set_concurrency(int n) {
+  if (init_called) {
+    printf("sthread_set_concurrency must be called before sthread_init.\n");
+    return;
+  }
+  ncarriers = n;
+}
+
+void sthread_user_set_quantum(int priority, int usec) {
+  if (usec <= 0) {
+    printf("sthread_set_quantum: the quantum must be positive.\n");
+    return;
+  }
+  quantum[sthread_priority_class(priority)] = usec;
+}
+
 void sthread_user_init(void) {
   sthread_t main_thread = (sthread_t) malloc(sizeof(struct _sthread));
   if (main_thread == NULL) {
@@ -58,52 +375,70 @@ void sthread_user_init(void) {
   main_thread->start_routine_args = NULL;
   main_thread->ret_val = NULL;
   main_thread->joinable = false;
+  main_thread->join_lock = 0;
   main_thread->join_caller = NULL;
   main_thread->has_terminated = false;
+  main_thread->name = "main";
+  main_thread->priority = 0;
+
+  if (ncarriers == 0 && getenv("STHREAD_CARRIERS") != NULL)
+    ncarriers = atoi(getenv("STHREAD_CARRIERS"));
+  if (ncarriers < 1)
+    ncarriers = 1;
+  if (ncarriers > MAX_CARRIERS)
+    ncarriers = MAX_CARRIERS;
+
+  // The main thread runs on carrier 0, which is the kernel thread that
+  // called us.
+  for (int i = 0; i < ncarriers; i++)
+    sthread_carrier_init(&carriers[i], i);
+  current_carrier = &carriers[0];
+  carriers[0].running_thread = main_thread;
 
   tid_counter++;
-  running_thread = main_thread;
-  ready_queue = sthread_new_queue();
-  dead_queue = sthread_new_queue();
-  dead_thread = NULL;
+  live_threads = 1;
   init_called = true;
 
-  sthread_preemption_init(sthread_user_yield, TIMEOUT);
-}
+  sthread_io_init();
 
-void sthread_run(void) {
-  int old = splx(LOW);
-  running_thread->ret_val = running_thread->start_routine(running_thread->start_routine_args);
+  sthread_preemption_init(sthread_user_yield, TIMEOUT);
+  // The main thread is alone for now; sthread_make_ready rearms the
+  // timer once another thread is ready.
+  int old = splx(HIGH);
+  sthread_preemption_disarm();
   splx(old);
-  sthread_user_exit(running_thread->ret_val);
-}
 
-void sthread_cleanup(void) {
-  int old = splx(HIGH);
-  if (sthread_queue_is_empty(ready_queue)) {
-    sthread_free_queue(ready_queue);
-
-    if (dead_thread != NULL) {
-      if (dead_thread->saved_ctx != NULL) { 
-        sthread_free_ctx(dead_thread->saved_ctx);
-        dead_thread->saved_ctx = NULL;
-      }
-      sthread_enqueue(dead_queue, dead_thread);
-      dead_thread = NULL;
+  // Start the other carriers, each with its own preemption timer.
+  for (int i = 1; i < ncarriers; i++) {
+    if (pthread_create(&carriers[i].pthread, NULL, sthread_carrier_main,
+                       &carriers[i]) != 0) {
+      printf("Error: cannot start carrier %d.\n", i);
+      exit(EXIT_FAILURE);
     }
-  
-    while (!sthread_queue_is_empty(dead_queue)) {
-      free(sthread_dequeue(dead_queue));
-    }
-    sthread_free_queue(dead_queue);
-
-    sthread_queue_clear_free_list();
+    pthread_detach(carriers[i].pthread);
   }
+}
+
+void sthread_run(void) {
+  sthread_finish_switch();
+
+  sthread_t self = sthread_carrier()->running_thread;
+  int old = splx(LOW);
+  self->ret_val = self->start_routine(self->start_routine_args);
   splx(old);
+  sthread_user_exit(self->ret_val);
 }
 
 sthread_t sthread_user_create(sthread_start_func_t start_routine, void *arg,
     int joinable) {
+  sthread_attr_t attr;
+  sthread_attr_init(&attr);
+  attr.detached = !joinable;
+  return sthread_user_create_attr(start_routine, arg, &attr);
+}
+
+sthread_t sthread_user_create_attr(sthread_start_func_t start_routine,
+                                   void *arg, const sthread_attr_t *attr) {
   if (!init_called) {
     printf("sthread_init hasn't been called yet.\n");
     return NULL;
@@ -120,17 +455,29 @@ sthread_t sthread_user_create(sthread_start_func_t start_routine, void *arg,
     return NULL;
   }
 
-  new_thread->saved_ctx = sthread_new_ctx(sthread_run);
   new_thread->start_routine = start_routine;
   new_thread->start_routine_args = arg;
   new_thread->ret_val = NULL;
-  new_thread->joinable = joinable;
+  new_thread->joinable = !attr->detached;
+  new_thread->join_lock = 0;
   new_thread->join_caller = NULL;
   new_thread->has_terminated = false;
+  new_thread->name = attr->name;
+  new_thread->priority = attr->priority;
 
   int old = splx(HIGH);
-  new_thread->tid = tid_counter++;
-  sthread_enqueue(ready_queue, new_thread);
+  new_thread->saved_ctx = sthread_new_ctx(sthread_run, attr->stack_size);
+  if (new_thread->saved_ctx == NULL) {
+    splx(old);
+    free(new_thread);
+    printf("Unable to create new thread.\n");
+    return NULL;
+  }
+  new_thread->tid = __sync_fetch_and_add(&tid_counter, 1);
+  __sync_fetch_and_add(&live_threads, 1);
+
+  // New threads start on this carrier, until an idle one steals them.
+  sthread_make_ready(sthread_carrier(), new_thread);
   splx(old);
 
   return new_thread;
@@ -142,55 +489,28 @@ void sthread_user_exit(void *ret) {
     exit(EXIT_FAILURE);
   }
 
-  int old = splx(HIGH);
+  splx(HIGH);
 
-  // Free the previously terminated thread's context
-  if (dead_thread != NULL) {
-    if (dead_thread->saved_ctx != NULL) {
-      sthread_free_ctx(dead_thread->saved_ctx);
-      dead_thread->saved_ctx = NULL;
-    }
-    sthread_enqueue(dead_queue, dead_thread);
-  }
+  sthread_carrier_t *c = sthread_carrier();
+  sthread_t self = c->running_thread;
+  self->ret_val = ret;
 
-  // Thread is exiting
-  running_thread->has_terminated = true;
-  dead_thread = running_thread;
+  // The last thread to exit ends the process, as with pthreads.
+  if (__sync_sub_and_fetch(&live_threads, 1) == 0)
+    exit(EXIT_SUCCESS);
 
-  // Check if there is another blocked thread waiting to join
-  // on this thread
-  if (dead_thread->join_caller != NULL) {
-    running_thread = dead_thread->join_caller;
-    dead_thread->join_caller = NULL;
-    splx(old);
-    sthread_switch(dead_thread->saved_ctx, running_thread->saved_ctx);
-    //    splx(old);
-
-  // No thread is waiting to join on this thread, and there are
-  // threads remaining on the ready queue, dispatch it
-  } else if (!sthread_queue_is_empty(ready_queue)) {
-    running_thread = sthread_dequeue(ready_queue);
-    splx(old);
-    sthread_switch(dead_thread->saved_ctx, running_thread->saved_ctx);
-    //    splx(old);
-
-  // No thread is waiting to join, and the ready queue is empty,
-  // which means this is the main thread. Just free everything
-  // and exit.
-  } else {
-    sthread_cleanup();
-    sthread_free_ctx(running_thread->saved_ctx);
-    free(running_thread);
-
-    tid_counter = 0;
-    init_called = false;
-    running_thread = NULL;
-    ready_queue = NULL;
-    dead_queue = NULL;
-    dead_thread = NULL;
+  while (atomic_test_and_set(&self->join_lock)) {}
+  sthread_t joiner = self->join_caller;
+  self->join_caller = NULL;
+  atomic_clear(&self->join_lock);
 
-    exit(*((int *)ret));
-  }
+  // Hand the carrier straight to a thread waiting to join on us, if
+  // there is one. Our stack, and our struct unless we are joinable, are
+  // freed once we are off it.
+  c->switch_dead = self;
+  sthread_switch_to(self->saved_ctx,
+                    joiner != NULL ? joiner : sthread_take_ready(c));
+  assert(false);  // not reached
 }
 
 void* sthread_user_join(sthread_t t) {
@@ -204,20 +524,37 @@ void* sthread_user_join(sthread_t t) {
   }
 
   int old = splx(HIGH);
+  while (atomic_test_and_set(&t->join_lock)) {}
   if (!t->has_terminated) {
-    t->join_caller = running_thread;
-    running_thread = sthread_dequeue(ready_queue);
-    sthread_switch(t->join_caller->saved_ctx, running_thread->saved_ctx);
+    sthread_carrier_t *c = sthread_carrier();
+    sthread_t self = c->running_thread;
+    t->join_caller = self;
+    c->switch_unlock = &t->join_lock;
+    sthread_switch_to(self->saved_ctx, sthread_take_ready(c));
+  } else {
+    atomic_clear(&t->join_lock);
   }
+  splx(old);
 
-  if (t->saved_ctx != NULL) {
-    sthread_free_ctx(t->saved_ctx);
-    t->saved_ctx = NULL;
-  }
+  void *ret = t->ret_val;
+  free(t);
+  return ret;
+}
 
-  splx(old); // enable interrupt down here to avoid double free
+sthread_t sthread_user_running(void) {
+  return sthread_carrier()->running_thread;
+}
 
-  return t->ret_val;
+void sthread_user_park(lock_t *lock) {
+  sthread_carrier_t *c = sthread_carrier();
+  sthread_t self = c->running_thread;
+
+  c->switch_unlock = lock;
+  sthread_switch_to(self->saved_ctx, sthread_take_ready(c));
+}
+
+void sthread_user_wake(sthread_t t) {
+  sthread_make_ready(sthread_carrier(), t);
 }
 
 void sthread_user_yield(void) {
@@ -228,20 +565,21 @@ void sthread_user_yield(void) {
 
   int old = splx(HIGH);
 
-  if (!sthread_queue_is_empty(ready_queue)) {
-    sthread_t old_thread = running_thread;
-    sthread_enqueue(ready_queue, running_thread);
-    running_thread = sthread_dequeue(ready_queue);
-    sthread_switch(old_thread->saved_ctx, running_thread->saved_ctx);
-  } else {
-    if (dead_thread != NULL) {
-      if (dead_thread->saved_ctx != NULL) {
-	sthread_free_ctx(dead_thread->saved_ctx);
-	dead_thread->saved_ctx = NULL;
-      }
-      sthread_enqueue(dead_queue, dead_thread);
-      dead_thread = NULL;
-    }
+  // An idle carrier can be interrupted too, but has nothing to yield.
+  sthread_carrier_t *c = sthread_carrier();
+  sthread_t self = c->running_thread;
+  // A busy carrier never goes idle to look for ready I/O, so look on
+  // every tick while threads are parked on it (this costs nothing when
+  // none are). Not in sthread_take_ready, which a thread that is parking
+  // on I/O calls while holding its waiter's spinlock.
+  sthread_io_poll(0);
+  sthread_t next = (self != NULL) ? sthread_take_ready(c) : NULL;
+  if (next != NULL) {
+    c->switch_ready = self;
+    sthread_switch_to(self->saved_ctx, next);
+  } else if (!sthread_io_has_waiters()) {
+    // Nothing else to run here: stop the timer until there is.
+    sthread_preemption_disarm();
   }
 
   splx(old);
@@ -281,23 +619,25 @@ void sthread_user_mutex_lock(sthread_mutex_t lock) {
     return;
   }
 
+  // The spinlock is only ever taken with interrupts disabled, so its
+  // holder can't be preempted while other threads spin on it.
+  int old = splx(HIGH);
+  sthread_t self = sthread_carrier()->running_thread;
   while (atomic_test_and_set(&(lock->mutex_lock))) {}
 
+  // The spinlock is released once we have switched away, so that an
+  // unlock on another carrier can't wake us before we have gone.
   while (lock->tid != -1) {
-    int old = splx(HIGH);
-    sthread_t old_thread = running_thread;
-    sthread_enqueue(lock->blocked_queue, running_thread);
-    atomic_clear(&(lock->mutex_lock));
-    running_thread = sthread_dequeue(ready_queue);
-    sthread_switch(old_thread->saved_ctx, running_thread->saved_ctx);
-    splx(old);
+    sthread_carrier_t *c = sthread_carrier();
+    sthread_enqueue(lock->blocked_queue, self);
+    c->switch_unlock = &(lock->mutex_lock);
+    sthread_switch_to(self->saved_ctx, sthread_take_ready(c));
     while (atomic_test_and_set(&(lock->mutex_lock))) {}
   }
 
-  int old = splx(HIGH);
-  lock->tid = running_thread->tid;
-  splx(old);
+  lock->tid = self->tid;
   atomic_clear(&(lock->mutex_lock));
+  splx(old);
 }
 
 void sthread_user_mutex_unlock(sthread_mutex_t lock) {
@@ -305,10 +645,13 @@ void sthread_user_mutex_unlock(sthread_mutex_t lock) {
     return;
   }
 
+  int old = splx(HIGH);
+  sthread_t self = sthread_carrier()->running_thread;
   while (atomic_test_and_set(&(lock->mutex_lock))) {}
 
-  if (lock->tid != running_thread->tid) {
+  if (lock->tid != self->tid) {
     atomic_clear(&(lock->mutex_lock));
+    splx(old);
     return;
   }
 
@@ -317,13 +660,12 @@ void sthread_user_mutex_unlock(sthread_mutex_t lock) {
   // be dispatched some time
   if (!sthread_queue_is_empty(lock->blocked_queue)) {
     sthread_t thread = sthread_dequeue(lock->blocked_queue);
-    int old = splx(HIGH);
-    sthread_enqueue(ready_queue, thread);
-    splx(old);
+    sthread_make_ready(sthread_carrier(), thread);
   }
 
   lock->tid = -1;
   atomic_clear(&(lock->mutex_lock));
+  splx(old);
 }
 
 
@@ -357,16 +699,13 @@ void sthread_user_cond_signal(sthread_cond_t cond) {
     return;
   }
 
+  int old = splx(HIGH);
   while (atomic_test_and_set(&(cond->cond_lock))) {}
-  if (sthread_queue_is_empty(cond->cond_queue)) {
-    atomic_clear(&(cond->cond_lock));
-    return;
+  if (!sthread_queue_is_empty(cond->cond_queue)) {
+    sthread_t released_thread = sthread_dequeue(cond->cond_queue);
+    sthread_make_ready(sthread_carrier(), released_thread);
   }
-  sthread_t released_thread = sthread_dequeue(cond->cond_queue);
   atomic_clear(&(cond->cond_lock));
-
-  int old = splx(HIGH);
-  sthread_enqueue(ready_queue, released_thread);
   splx(old);
 }
 
@@ -375,15 +714,15 @@ void sthread_user_cond_broadcast(sthread_cond_t cond) {
     return;
   }
 
+  int old = splx(HIGH);
   while (atomic_test_and_set(&(cond->cond_lock))) {}
   sthread_t released_thread;
   while (!sthread_queue_is_empty(cond->cond_queue)) {
     released_thread = sthread_dequeue(cond->cond_queue);
-    int old = splx(HIGH);
-    sthread_enqueue(ready_queue, released_thread);
-    splx(old);
+    sthread_make_ready(sthread_carrier(), released_thread);
   }
   atomic_clear(&(cond->cond_lock));
+  splx(old);
 }
 
 void sthread_user_cond_wait(sthread_cond_t cond, sthread_mutex_t lock) {
@@ -391,17 +730,20 @@ void sthread_user_cond_wait(sthread_cond_t cond, sthread_mutex_t lock) {
     return;
   }
 
-  sthread_user_mutex_unlock(lock);
-
-  while (atomic_test_and_set(&(cond->cond_lock))) {}
+  // Join the condition's queue before releasing the lock, and hold the
+  // condition's spinlock until we have switched away, so that a signal
+  // sent as soon as the lock is free can neither be lost nor wake us
+  // before we have gone.
   int old = splx(HIGH);
-  sthread_enqueue(cond->cond_queue, running_thread);
-  atomic_clear(&(cond->cond_lock));
+  sthread_carrier_t *c = sthread_carrier();
+  sthread_t self = c->running_thread;
+  while (atomic_test_and_set(&(cond->cond_lock))) {}
+  sthread_enqueue(cond->cond_queue, self);
+
+  sthread_user_mutex_unlock(lock);
 
-  sthread_t wait_thread = running_thread;
-  sthread_t thread = sthread_dequeue(ready_queue);
-  running_thread = thread;
-  sthread_switch(wait_thread->saved_ctx, running_thread->saved_ctx);
+  c->switch_unlock = &(cond->cond_lock);
+  sthread_switch_to(self->saved_ctx, sthread_take_ready(c));
   splx(old);
 
   sthread_user_mutex_lock(lock);
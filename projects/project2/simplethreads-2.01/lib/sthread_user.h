@@ -8,14 +8,29 @@
 #ifndef STHREAD_USER_H
 #define STHREAD_USER_H 1
 
+#include <sthread_preempt.h>
+
 /* Part 1: Basic Threads */
 void sthread_user_init(void);
+void sthread_user_set_concurrency(int ncarriers);
+void sthread_user_set_quantum(int priority, int usec);
+void sthread_user_print_stats(void);
 sthread_t sthread_user_create(sthread_start_func_t start_routine, void *arg,
                               int joinable);
+sthread_t sthread_user_create_attr(sthread_start_func_t start_routine,
+                                   void *arg, const sthread_attr_t *attr);
 void sthread_user_exit(void *ret);
 void sthread_user_yield(void);
 void* sthread_user_join(sthread_t t);
 
+/* For sthread_io.c, with interrupts disabled: the calling thread;
+ * block the calling thread until it is woken, releasing lock, which
+ * the caller holds, once it has switched away; and make t ready to run
+ * on the calling carrier. */
+sthread_t sthread_user_running(void);
+void sthread_user_park(lock_t *lock);
+void sthread_user_wake(sthread_t t);
+
 /* Part 2: Synchronization Primitives */
 sthread_mutex_t sthread_user_mutex_init(void);
 void sthread_user_mutex_free(sthread_mutex_t lock);
@@ -0,0 +1,100 @@
+/* Test of thread attributes: small stacks, names, priority hints and
+ * detached threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sthread.h>
+
+#define NUM_THREADS 100
+
+sthread_mutex_t mutex;
+sthread_cond_t done_cond;
+int detached_done = 0;
+
+/* Uses a good part of a 32 KB stack, and returns the sum of what it
+ * wrote so that the work can't be optimized away. */
+void *small_stack_start(void *arg) {
+  char buf[16 * 1024];
+  long sum = 0;
+  size_t i;
+
+  memset(buf, (int)(long)arg, sizeof(buf));
+  for (i = 0; i < sizeof(buf); i += 512)
+    sum += buf[i];
+  return (void *)sum;
+}
+
+void *detached_start(void *arg) {
+  sthread_mutex_lock(mutex);
+  detached_done++;
+  sthread_cond_signal(done_cond);
+  sthread_mutex_unlock(mutex);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  sthread_attr_t attr;
+  sthread_t threads[NUM_THREADS];
+  int i;
+
+  printf("Testing sthread_create_attr, impl: %s\n",
+         (sthread_get_impl() == STHREAD_PTHREAD_IMPL) ? "pthread" : "user");
+
+  sthread_init();
+
+  mutex = sthread_mutex_init();
+  done_cond = sthread_cond_init();
+
+  sthread_attr_init(&attr);
+  if (attr.stack_size != 0 || attr.name != NULL || attr.priority != 0 ||
+      attr.detached != 0) {
+    printf("sthread_attr_init did not set the defaults\n");
+    exit(1);
+  }
+
+  /* joinable threads with 32 KB stacks */
+  attr.stack_size = 32 * 1024;
+  attr.name = "small";
+  attr.priority = 1;
+  for (i = 0; i < NUM_THREADS; i++) {
+    threads[i] = sthread_create_attr(small_stack_start, (void *)(long)(i % 7),
+                                     &attr);
+    if (threads[i] == NULL) {
+      printf("sthread_create_attr failed\n");
+      exit(1);
+    }
+  }
+  for (i = 0; i < NUM_THREADS; i++) {
+    long expected = (i % 7) * (16 * 1024 / 512);
+    if ((long)sthread_join(threads[i]) != expected) {
+      printf("thread %d returned the wrong value\n", i);
+      exit(1);
+    }
+  }
+
+  /* detached threads, with the default stack size */
+  sthread_attr_init(&attr);
+  attr.detached = 1;
+  for (i = 0; i < NUM_THREADS; i++) {
+    if (sthread_create_attr(detached_start, NULL, &attr) == NULL) {
+      printf("sthread_create_attr failed\n");
+      exit(1);
+    }
+  }
+  sthread_mutex_lock(mutex);
+  while (detached_done < NUM_THREADS)
+    sthread_cond_wait(done_cond, mutex);
+  sthread_mutex_unlock(mutex);
+
+  /* NULL attributes mean the defaults */
+  threads[0] = sthread_create_attr(small_stack_start, (void *)1L, NULL);
+  if ((long)sthread_join(threads[0]) != 16 * 1024 / 512) {
+    printf("thread with default attributes returned the wrong value\n");
+    exit(1);
+  }
+
+  printf("sthread_create_attr passed\n");
+  return 0;
+}
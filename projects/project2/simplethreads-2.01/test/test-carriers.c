@@ -0,0 +1,105 @@
+/* Test of running threads on several carriers (kernel threads): many
+ * threads contending for a mutex, a condition variable ping-pong,
+ * joins, and the main thread exiting before the threads it created.
+ * With the pthread implementation the number of carriers is ignored,
+ * and this is just another mutex and condition test.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sthread.h>
+
+#define NUM_CARRIERS 4
+#define NUM_THREADS 16
+#define NUM_INCREMENTS 10000
+#define NUM_ROUNDS 1000
+
+sthread_mutex_t mutex;
+sthread_cond_t turn_cond;
+long counter = 0;
+int turn = 0;
+
+void *increment_start(void *arg) {
+  int i;
+
+  for (i = 0; i < NUM_INCREMENTS; i++) {
+    sthread_mutex_lock(mutex);
+    counter++;
+    sthread_mutex_unlock(mutex);
+    if (i % 100 == 0)
+      sthread_yield();
+  }
+  return arg;
+}
+
+/* Two of these take turns, each waiting for the other to hand over. */
+void *turn_start(void *arg) {
+  int me = (int)(long)arg;
+  int i;
+
+  for (i = 0; i < NUM_ROUNDS; i++) {
+    sthread_mutex_lock(mutex);
+    while (turn != me)
+      sthread_cond_wait(turn_cond, mutex);
+    turn = 1 - me;
+    sthread_cond_signal(turn_cond);
+    sthread_mutex_unlock(mutex);
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  sthread_t threads[NUM_THREADS];
+  sthread_t turns[2];
+  long i;
+
+  printf("Testing multiple carriers, impl: %s\n",
+         (sthread_get_impl() == STHREAD_PTHREAD_IMPL) ? "pthread" : "user");
+
+  sthread_set_concurrency(NUM_CARRIERS);
+  sthread_init();
+
+  mutex = sthread_mutex_init();
+  turn_cond = sthread_cond_init();
+
+  for (i = 0; i < NUM_THREADS; i++) {
+    threads[i] = sthread_create(increment_start, (void *)i, 1);
+    if (threads[i] == NULL) {
+      printf("sthread_create failed\n");
+      exit(1);
+    }
+  }
+  for (i = 0; i < 2; i++) {
+    turns[i] = sthread_create(turn_start, (void *)i, 1);
+    if (turns[i] == NULL) {
+      printf("sthread_create failed\n");
+      exit(1);
+    }
+  }
+
+  for (i = 0; i < NUM_THREADS; i++) {
+    if (sthread_join(threads[i]) != (void *)i) {
+      printf("join of thread %ld returned the wrong value\n", i);
+      exit(1);
+    }
+  }
+  for (i = 0; i < 2; i++)
+    sthread_join(turns[i]);
+
+  if (counter != (long)NUM_THREADS * NUM_INCREMENTS) {
+    printf("counter is %ld, expected %ld\n", counter,
+           (long)NUM_THREADS * NUM_INCREMENTS);
+    exit(1);
+  }
+
+  /* The process must live on until the last thread exits. */
+  for (i = 0; i < NUM_THREADS; i++) {
+    if (sthread_create(increment_start, NULL, 0) == NULL) {
+      printf("sthread_create failed\n");
+      exit(1);
+    }
+  }
+  printf("multiple carriers passed\n");
+  sthread_exit(NULL);
+  return 1;
+}
@@ -0,0 +1,310 @@
+/* Test of the I/O wrappers: a thread reading from an empty pipe must
+ * let the other threads run, and be woken when data arrives even while
+ * another thread spins without yielding, a write bigger than the pipe
+ * must let the reader at the other end run, a reader and a writer waiting on the same
+ * socket must both be woken, and a file sent with sthread_sendfile
+ * over a connection made with sthread_accept must arrive intact, with
+ * the sender and receiver in different threads. The file is bigger than
+ * the socket buffers, so the sender has to wait for the receiver.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sthread.h>
+
+#define FILE_SIZE (4 * 1024 * 1024)
+#define WRITE_SIZE (64 * 1024)
+#define PIPE_WRITE_SIZE (256 * 1024)
+
+static const char MESSAGE[] = "hello";
+
+int pipe_fds[2];
+int pair_fds[2];
+int listen_socket;
+char *file_data;
+
+void *pipe_reader_start(void *arg) {
+  static char buf[sizeof(MESSAGE)];
+  size_t count = 0;
+  ssize_t rd;
+
+  while (count < sizeof(MESSAGE) &&
+         (rd = sthread_read(pipe_fds[0], buf + count,
+                            sizeof(MESSAGE) - count)) > 0)
+    count += rd;
+  return buf;
+}
+
+/* Reads the message from pipe_fds[0], then says it has. */
+volatile int spin_reader_done = 0;
+
+void *spin_reader_start(void *arg) {
+  pipe_reader_start(arg);
+  spin_reader_done = 1;
+  return NULL;
+}
+
+/* Reads PIPE_WRITE_SIZE bytes from pipe_fds[0]. */
+void *pipe_drainer_start(void *arg) {
+  static char buf[PIPE_WRITE_SIZE];
+  size_t count = 0;
+  ssize_t rd;
+
+  while (count < PIPE_WRITE_SIZE &&
+         (rd = sthread_read(pipe_fds[0], buf + count,
+                            PIPE_WRITE_SIZE - count)) > 0)
+    count += rd;
+  return (void *)count;
+}
+
+/* Reads the message from pair_fds[0]. */
+void *pair_reader_start(void *arg) {
+  static char buf[sizeof(MESSAGE)];
+  size_t count = 0;
+  ssize_t rd;
+
+  while (count < sizeof(MESSAGE) &&
+         (rd = sthread_read(pair_fds[0], buf + count,
+                            sizeof(MESSAGE) - count)) > 0)
+    count += rd;
+  return buf;
+}
+
+/* Writes WRITE_SIZE bytes to pair_fds[0], whose buffer is already full. */
+void *pair_writer_start(void *arg) {
+  static char buf[WRITE_SIZE];
+  size_t count = 0;
+  ssize_t wr;
+
+  while (count < WRITE_SIZE &&
+         (wr = sthread_write(pair_fds[0], buf + count,
+                             WRITE_SIZE - count)) > 0)
+    count += wr;
+  return (void *)count;
+}
+
+/* Accepts one connection, waits for a one-byte request, and answers it
+ * with the whole file. */
+void *server_start(void *arg) {
+  FILE *file;
+  off_t offset = 0;
+  ssize_t sent;
+  char request;
+  int conn;
+
+  conn = sthread_accept(listen_socket, NULL, NULL);
+  if (conn == -1) {
+    perror("sthread_accept");
+    exit(1);
+  }
+  if (sthread_read(conn, &request, 1) != 1) {
+    printf("server read failed\n");
+    exit(1);
+  }
+
+  file = tmpfile();
+  if (file == NULL || fwrite(file_data, 1, FILE_SIZE, file) != FILE_SIZE ||
+      fflush(file) != 0) {
+    printf("cannot write the temporary file\n");
+    exit(1);
+  }
+  while (offset < FILE_SIZE) {
+    sent = sthread_sendfile(conn, fileno(file), &offset, FILE_SIZE - offset);
+    if (sent <= 0) {
+      perror("sthread_sendfile");
+      exit(1);
+    }
+  }
+  fclose(file);
+  close(conn);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  sthread_t reader, writer, server;
+  char *received;
+  char buf[4096];
+  size_t count, filled;
+  ssize_t rd;
+  time_t start;
+  int conn, i;
+
+  printf("Testing sthread I/O, impl: %s\n",
+         (sthread_get_impl() == STHREAD_PTHREAD_IMPL) ? "pthread" : "user");
+
+  /* On one carrier, a thread that blocked its carrier rather than
+   * parking would hang the test rather than just slow it down. */
+  sthread_set_concurrency(1);
+  sthread_init();
+
+  /* A reader blocked on an empty pipe; we must still get to run, and
+   * write what it is waiting for. */
+  if (pipe(pipe_fds) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+  reader = sthread_create(pipe_reader_start, NULL, 1);
+  if (reader == NULL) {
+    printf("sthread_create failed\n");
+    exit(1);
+  }
+  for (i = 0; i < 10; i++)
+    sthread_yield();
+  if (sthread_write(pipe_fds[1], MESSAGE, sizeof(MESSAGE)) !=
+      sizeof(MESSAGE)) {
+    printf("pipe write failed\n");
+    exit(1);
+  }
+  if (strcmp((char *)sthread_join(reader), MESSAGE) != 0) {
+    printf("the reader read the wrong message\n");
+    exit(1);
+  }
+
+  /* The reader must be woken by the data even though we spin, never
+   * yielding or calling into the library, until it has been. */
+  reader = sthread_create(spin_reader_start, NULL, 1);
+  if (reader == NULL) {
+    printf("sthread_create failed\n");
+    exit(1);
+  }
+  for (i = 0; i < 10; i++)
+    sthread_yield();
+  if (write(pipe_fds[1], MESSAGE, sizeof(MESSAGE)) != sizeof(MESSAGE)) {
+    printf("pipe write failed\n");
+    exit(1);
+  }
+  start = time(NULL);
+  while (!spin_reader_done) {
+    if (time(NULL) - start > 5) {
+      printf("the reader wasn't woken while the main thread spun\n");
+      exit(1);
+    }
+  }
+  sthread_join(reader);
+
+  /* A write much bigger than the pipe holds, which the reader has to
+   * make room for as it goes. */
+  file_data = calloc(1, PIPE_WRITE_SIZE);
+  reader = sthread_create(pipe_drainer_start, NULL, 1);
+  if (file_data == NULL || reader == NULL) {
+    printf("cannot start the pipe reader\n");
+    exit(1);
+  }
+  count = 0;
+  while (count < PIPE_WRITE_SIZE &&
+         (rd = sthread_write(pipe_fds[1], file_data + count,
+                             PIPE_WRITE_SIZE - count)) > 0)
+    count += rd;
+  if (count != PIPE_WRITE_SIZE ||
+      (size_t)sthread_join(reader) != PIPE_WRITE_SIZE) {
+    printf("wrote %lu bytes to the pipe, expected %d\n",
+           (unsigned long)count, PIPE_WRITE_SIZE);
+    exit(1);
+  }
+  free(file_data);
+
+  /* A reader and a writer both waiting on one end of a socket pair:
+   * the writer because the buffer is full, the reader because nothing
+   * has been sent. Each must be woken by its own event. */
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair_fds) != 0) {
+    perror("socketpair");
+    exit(1);
+  }
+  memset(buf, 0, sizeof(buf));
+  filled = 0;
+  while ((rd = send(pair_fds[0], buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+    filled += rd;
+  reader = sthread_create(pair_reader_start, NULL, 1);
+  writer = sthread_create(pair_writer_start, NULL, 1);
+  if (reader == NULL || writer == NULL) {
+    printf("sthread_create failed\n");
+    exit(1);
+  }
+  for (i = 0; i < 10; i++)
+    sthread_yield();
+  if (sthread_write(pair_fds[1], MESSAGE, sizeof(MESSAGE)) !=
+      sizeof(MESSAGE)) {
+    printf("socket pair write failed\n");
+    exit(1);
+  }
+  if (strcmp((char *)sthread_join(reader), MESSAGE) != 0) {
+    printf("the socket pair reader read the wrong message\n");
+    exit(1);
+  }
+  count = 0;
+  while (count < filled + WRITE_SIZE &&
+         (rd = sthread_read(pair_fds[1], buf, sizeof(buf))) > 0)
+    count += rd;
+  if ((size_t)sthread_join(writer) != WRITE_SIZE ||
+      count != filled + WRITE_SIZE) {
+    printf("the socket pair writer wrote %lu bytes, expected %lu\n",
+           (unsigned long)count, (unsigned long)(filled + WRITE_SIZE));
+    exit(1);
+  }
+  close(pair_fds[0]);
+  close(pair_fds[1]);
+
+  /* A file sent from one thread to another through a socket. */
+  file_data = malloc(FILE_SIZE);
+  received = malloc(FILE_SIZE);
+  if (file_data == NULL || received == NULL) {
+    printf("out of memory\n");
+    exit(1);
+  }
+  for (i = 0; i < FILE_SIZE; i++)
+    file_data[i] = (char)(i * 7 + i / 4096);
+
+  listen_socket = socket(PF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  if (listen_socket == -1 ||
+      bind(listen_socket, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listen_socket, 1) != 0 ||
+      getsockname(listen_socket, (struct sockaddr *)&addr, &len) != 0) {
+    perror("cannot listen on the loopback interface");
+    exit(1);
+  }
+
+  server = sthread_create(server_start, NULL, 1);
+  if (server == NULL) {
+    printf("sthread_create failed\n");
+    exit(1);
+  }
+
+  conn = socket(PF_INET, SOCK_STREAM, 0);
+  if (conn == -1 ||
+      connect(conn, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    perror("cannot connect to the server");
+    exit(1);
+  }
+  if (sthread_write(conn, "G", 1) != 1) {
+    printf("client write failed\n");
+    exit(1);
+  }
+  count = 0;
+  while (count < FILE_SIZE &&
+         (rd = sthread_read(conn, received + count, FILE_SIZE - count)) > 0)
+    count += rd;
+  sthread_join(server);
+
+  if (count != FILE_SIZE || memcmp(received, file_data, FILE_SIZE) != 0) {
+    printf("received %lu bytes, expected %d, or the data differs\n",
+           (unsigned long)count, FILE_SIZE);
+    exit(1);
+  }
+  close(conn);
+  close(listen_socket);
+
+  printf("sthread I/O passed\n");
+  return 0;
+}
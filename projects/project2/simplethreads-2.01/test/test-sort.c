@@ -0,0 +1,99 @@
+/* Test of sioux's queue_sort_parallel: a queue big enough to be split
+ * between several sthreads must come out sorted, with elements of
+ * equal keys in their original order, and the empty and one-element
+ * queues must be left as they are.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sthread.h>
+#include "../web/queue.h"
+
+#define NUM_CARRIERS 4
+#define NUM_WORKERS 4
+#define NUM_ELEMENTS 100000
+#define NUM_KEYS 1000
+
+typedef struct {
+  int key;
+  int seq;   // position in the queue before sorting
+} element;
+
+element elements[NUM_ELEMENTS];
+
+int compare_keys(queue_element *e1, queue_element *e2) {
+  int k1 = ((element *)e1)->key;
+  int k2 = ((element *)e2)->key;
+
+  return (k1 > k2) - (k1 < k2);
+}
+
+typedef struct {
+  element *prev;
+  size_t count;
+  int ok;
+} check_state;
+
+/* Checks that elem comes after the previous element in sorted order. */
+bool check_order(queue_element *elem, queue_function_args *args) {
+  check_state *state = (check_state *)args;
+  element *e = (element *)elem;
+
+  if (state->prev != NULL &&
+      (state->prev->key > e->key ||
+       (state->prev->key == e->key && state->prev->seq > e->seq)))
+    state->ok = 0;
+  state->prev = e;
+  state->count++;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  check_state state = { NULL, 0, 1 };
+  queue_element *elem;
+  queue *q;
+  int i;
+
+  printf("Testing queue_sort_parallel, impl: %s\n",
+         (sthread_get_impl() == STHREAD_PTHREAD_IMPL) ? "pthread" : "user");
+
+  sthread_set_concurrency(NUM_CARRIERS);
+  sthread_init();
+
+  /* An empty queue. */
+  q = queue_create();
+  queue_sort_parallel(q, compare_keys, NUM_WORKERS);
+  if (!queue_is_empty(q)) {
+    printf("the empty queue is no longer empty\n");
+    exit(1);
+  }
+
+  /* One element. */
+  queue_append(q, &elements[0]);
+  queue_sort_parallel(q, compare_keys, NUM_WORKERS);
+  if (queue_size(q) != 1 || !queue_remove(q, &elem) ||
+      elem != &elements[0]) {
+    printf("the one-element queue changed\n");
+    exit(1);
+  }
+
+  /* Many elements with few distinct keys, so that equal keys end up in
+   * different runs and the merge has to keep them in order. */
+  srand(1);
+  for (i = 0; i < NUM_ELEMENTS; i++) {
+    elements[i].key = rand() % NUM_KEYS;
+    elements[i].seq = i;
+    queue_append(q, &elements[i]);
+  }
+  queue_sort_parallel(q, compare_keys, NUM_WORKERS);
+  queue_apply(q, check_order, &state);
+  if (state.count != NUM_ELEMENTS || !state.ok) {
+    printf("the queue of %lu elements is not sorted stably\n",
+           (unsigned long)state.count);
+    exit(1);
+  }
+  queue_destroy(q);
+
+  printf("queue_sort_parallel passed\n");
+  return 0;
+}
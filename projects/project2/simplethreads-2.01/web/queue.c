@@ -13,6 +13,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sthread.h>
 #include "queue.h"
 
 /* Each link in the queue stores a queue_element and
@@ -22,10 +23,24 @@ typedef struct _queue_link {
   struct _queue_link* next;
 } queue_link;
 
+/* Number of links carved out of each slab. */
+#define QUEUE_SLAB_LINKS 64
+
+/* Links are allocated a slab at a time. Every slab a queue has
+ * allocated stays on its list of slabs until the queue is destroyed. */
+typedef struct _queue_slab {
+  struct _queue_slab* next;
+  queue_link links[QUEUE_SLAB_LINKS];
+} queue_slab;
+
 /* This is the actual implementation of the queue struct that
- * is declared in queue.h. */
+ * is declared in queue.h. Links of removed elements go onto the
+ * queue's free list and are reused by later appends, so a queue whose
+ * length stays bounded stops calling malloc and free. */
 struct _queue {
   queue_link* head;
+  queue_link* free_links;  // unused links, chained through next
+  queue_slab* slabs;       // every slab allocated for this queue
 };
 
 queue* queue_create() {
@@ -33,13 +48,33 @@ queue* queue_create() {
   assert(q != NULL);
 
   q->head = NULL;
+  q->free_links = NULL;
+  q->slabs = NULL;
   return q;
 }
 
+/* Private: allocates a new slab and puts all of its links on the
+ * free list. */
+static void queue_refill_links(queue* q) {
+  queue_slab* slab = (queue_slab*) malloc(sizeof(queue_slab));
+  assert(slab != NULL);
+
+  slab->next = q->slabs;
+  q->slabs = slab;
+
+  for (int i = 0; i < QUEUE_SLAB_LINKS; i++) {
+    slab->links[i].next = q->free_links;
+    q->free_links = &slab->links[i];
+  }
+}
+
 /* Private */
-static queue_link* queue_new_element(queue_element* elem) {
-  queue_link* ql = (queue_link*) malloc(sizeof(queue_link));
-  assert(ql != NULL);
+static queue_link* queue_new_element(queue* q, queue_element* elem) {
+  if (q->free_links == NULL)
+    queue_refill_links(q);
+
+  queue_link* ql = q->free_links;
+  q->free_links = ql->next;
 
   ql->elem = elem;
   ql->next = NULL;
@@ -47,12 +82,18 @@ static queue_link* queue_new_element(queue_element* elem) {
   return ql;
 }
 
+/* Private: returns a link to the free list of its queue. */
+static void queue_free_link(queue* q, queue_link* ql) {
+  ql->next = q->free_links;
+  q->free_links = ql;
+}
+
 void queue_append(queue* q, queue_element* elem) {
   assert(q != NULL);
 
   // Bug 1
   if (queue_is_empty(q)) {
-    q->head = queue_new_element(elem);
+    q->head = queue_new_element(q, elem);
 
   } else {
     // Find the last link in the queue.
@@ -60,7 +101,7 @@ void queue_append(queue* q, queue_element* elem) {
     for (cur = q->head; cur->next; cur = cur->next) {}
 
     // Append the new link.
-    cur->next = queue_new_element(elem);
+    cur->next = queue_new_element(q, elem);
   }
 }
 
@@ -78,12 +119,69 @@ bool queue_remove(queue* q, queue_element** elem_ptr) {
   q->head = q->head->next;
 
   // Bug 2
-  free(old_head);
+  queue_free_link(q, old_head);
   old_head = NULL;
 
   return true;
 }
 
+void queue_append_n(queue* q, queue_element** elems, size_t n) {
+  assert(q != NULL);
+  assert(elems != NULL || n == 0);
+
+  // find the last link once, then link the new elements after it
+  queue_link head;
+  queue_link* tail = &head;
+  head.next = q->head;
+  while (tail->next != NULL)
+    tail = tail->next;
+
+  for (size_t i = 0; i < n; i++) {
+    tail->next = queue_new_element(q, elems[i]);
+    tail = tail->next;
+  }
+  q->head = head.next;
+}
+
+size_t queue_drain(queue* q, queue_element** out, size_t max) {
+  assert(q != NULL);
+  assert(out != NULL || max == 0);
+
+  size_t done = 0;
+  while (done < max && q->head != NULL) {
+    queue_link* old_head = q->head;
+    out[done++] = old_head->elem;
+    q->head = old_head->next;
+    queue_free_link(q, old_head);
+  }
+
+  return done;
+}
+
+void queue_concat(queue* q, queue* other) {
+  assert(q != NULL && other != NULL && q != other);
+
+  if (queue_is_empty(other))
+    return;
+
+  // find the last link of q once, then move other's elements over,
+  // returning other's links to its free list as we go
+  queue_link head;
+  queue_link* tail = &head;
+  head.next = q->head;
+  while (tail->next != NULL)
+    tail = tail->next;
+
+  while (other->head != NULL) {
+    queue_link* old_head = other->head;
+    tail->next = queue_new_element(q, old_head->elem);
+    tail = tail->next;
+    other->head = old_head->next;
+    queue_free_link(other, old_head);
+  }
+  q->head = head.next;
+}
+
 bool queue_is_empty(queue* q) {
   assert(q != NULL);
   return q->head == NULL;
@@ -139,43 +237,199 @@ void queue_reverse(queue* q) {
   }
 }
 
-static queue_link* find_smallest(queue_link* ql, queue_compare qc) {
-  assert(ql != NULL && qc != NULL);
+/* Merges the sorted lists a and b into one sorted list and returns its
+ * head, storing its last link in *tail_ptr. Ties are taken from a so
+ * that the merge is stable. */
+static queue_link* merge(queue_link* a, queue_link* b, queue_compare qc,
+                         queue_link** tail_ptr) {
+  queue_link head;
+  queue_link* tail = &head;
+
+  while (a != NULL && b != NULL) {
+    if (qc(b->elem, a->elem) < 0) {
+      tail->next = b;
+      b = b->next;
+    } else {
+      tail->next = a;
+      a = a->next;
+    }
+    tail = tail->next;
+  }
+  tail->next = (a != NULL ? a : b);
+
+  while (tail->next != NULL)
+    tail = tail->next;
+  *tail_ptr = tail;
+
+  return head.next;
+}
+
+/* Detaches the first n links of the list starting at ql and returns
+ * the rest of the list. */
+static queue_link* split(queue_link* ql, size_t n) {
+  for (size_t i = 1; ql != NULL && i < n; i++)
+    ql = ql->next;
 
-  queue_link* ret = ql;
-  queue_link* cur = ql;
+  if (ql == NULL)
+    return NULL;
 
-  while (cur != NULL) {
-    int compare = qc(cur->elem, ret->elem);
-    if (compare < 0) {
-      ret = cur;
+  queue_link* rest = ql->next;
+  ql->next = NULL;
+  return rest;
+}
+
+/* Bottom-up merge sort of the list of size links starting at ql: relinks
+ * the nodes without allocating, and returns the new head. */
+static queue_link* sort_list(queue_link* ql, size_t size, queue_compare qc) {
+  for (size_t width = 1; width < size; width *= 2) {
+    queue_link head;
+    queue_link* tail = &head;
+    queue_link* rest = ql;
+
+    // merge each pair of adjacent runs of the given width
+    while (rest != NULL) {
+      queue_link* left = rest;
+      queue_link* right = split(left, width);
+      rest = split(right, width);
+
+      queue_link* run_tail;
+      tail->next = merge(left, right, qc, &run_tail);
+      tail = run_tail;
     }
-    cur = cur->next;
+    ql = head.next;
   }
 
-  return ret;
+  return ql;
 }
 
 void queue_sort(queue* q, queue_compare qc) {
   assert(q != NULL && qc != NULL);
 
-  queue_link* cur = q->head;
+  q->head = sort_list(q->head, queue_size(q), qc);
+}
+
+/* Queues with fewer elements per thread than this are sorted on the
+ * calling thread alone; below it, thread creation costs more than the
+ * sorting work it would take over. */
+static const size_t PARALLEL_SORT_MIN_RUN = 4096;
+
+/* One run of the queue, sorted by its own worker thread. */
+typedef struct _sort_run {
+  queue_link* head;
+  size_t size;
+  queue_compare qc;
+  size_t index;  // position of the run in the queue, used to break ties
+} sort_run;
+
+static void* sort_run_worker(void* arg) {
+  sort_run* run = (sort_run*) arg;
+  run->head = sort_list(run->head, run->size, run->qc);
+  return NULL;
+}
+
+/* Returns true if the head of run a must be merged before the head of
+ * run b. Equal elements are taken from the earlier run, which keeps the
+ * k-way merge stable. */
+static bool run_before(sort_run* a, sort_run* b) {
+  int res = a->qc(a->head->elem, b->head->elem);
+  return res < 0 || (res == 0 && a->index < b->index);
+}
+
+/* Restores the min-heap property of heap[0..n) below index i. */
+static void heap_sift_down(sort_run** heap, size_t n, size_t i) {
+  while (2 * i + 1 < n) {
+    size_t child = 2 * i + 1;
+    if (child + 1 < n && run_before(heap[child + 1], heap[child]))
+      child++;
+    if (!run_before(heap[child], heap[i]))
+      break;
+
+    sort_run* temp = heap[i];
+    heap[i] = heap[child];
+    heap[child] = temp;
+    i = child;
+  }
+}
+
+void queue_sort_parallel(queue* q, queue_compare qc, int nthreads) {
+  assert(q != NULL && qc != NULL);
+
+  size_t q_size = queue_size(q);
+  size_t nruns = nthreads > 0 ? (size_t) nthreads : 1;
+  if (nruns > q_size / PARALLEL_SORT_MIN_RUN)
+    nruns = q_size / PARALLEL_SORT_MIN_RUN;
+  if (nruns < 2) {
+    queue_sort(q, qc);
+    return;
+  }
+
+  sort_run* runs = (sort_run*) malloc(nruns * sizeof(sort_run));
+  sort_run** heap = (sort_run**) malloc(nruns * sizeof(sort_run*));
+  sthread_t* workers = (sthread_t*) malloc(nruns * sizeof(sthread_t));
+  if (runs == NULL || heap == NULL || workers == NULL) {
+    free(workers);
+    free(heap);
+    free(runs);
+    queue_sort(q, qc);
+    return;
+  }
 
-  while (cur != NULL && cur->next != NULL) {
-    queue_link* smallest = find_smallest(cur, qc);
-    queue_element* temp = cur->elem;
-    cur->elem = smallest->elem;
-    smallest->elem = temp;
+  // cut the list into nruns runs of (almost) equal size
+  queue_link* rest = q->head;
+  for (size_t i = 0; i < nruns; i++) {
+    runs[i].head = rest;
+    runs[i].size = q_size / nruns + (i < q_size % nruns ? 1 : 0);
+    runs[i].qc = qc;
+    runs[i].index = i;
+    rest = split(rest, runs[i].size);
+  }
 
-    cur = cur->next;
+  // sort all but the first run on worker threads, and the first
+  // run on this thread while they work; a run whose worker can't be
+  // created is sorted on this thread too
+  for (size_t i = 1; i < nruns; i++)
+    workers[i] = sthread_create(sort_run_worker, &runs[i], 1);
+  sort_run_worker(&runs[0]);
+  for (size_t i = 1; i < nruns; i++) {
+    if (workers[i] != NULL)
+      sthread_join(workers[i]);
+    else
+      sort_run_worker(&runs[i]);
   }
+
+  // k-way merge: repeatedly take the smallest run head off the heap
+  for (size_t i = 0; i < nruns; i++)
+    heap[i] = &runs[i];
+  for (size_t i = nruns / 2; i-- > 0; )
+    heap_sift_down(heap, nruns, i);
+
+  queue_link head;
+  queue_link* tail = &head;
+  size_t nheap = nruns;
+  while (nheap > 0) {
+    sort_run* run = heap[0];
+    tail->next = run->head;
+    tail = run->head;
+    run->head = run->head->next;
+
+    if (run->head == NULL)
+      heap[0] = heap[--nheap];
+    heap_sift_down(heap, nheap, 0);
+  }
+  tail->next = NULL;
+  q->head = head.next;
+
+  free(workers);
+  free(heap);
+  free(runs);
 }
 
 void queue_destroy(queue* q) {
-  queue_link* cur;
-  queue_link* next;
+  queue_slab* cur;
+  queue_slab* next;
   if (q != NULL) {
-    cur = q->head;
+    // every link, in use or free, lives in one of the slabs
+    cur = q->slabs;
     while (cur) {
       next = cur->next;
       free(cur);
@@ -28,7 +28,30 @@ void queue_append(queue* q, queue_element* elem);
 bool queue_remove(queue* q, queue_element** elem_ptr);
 
 /*
- * Destroys the queue.
+ * Appends the n elements of the given array to the end of the queue,
+ * in array order. The queue is walked to its end once, rather than once
+ * per element as n calls to queue_append would.
+ */
+void queue_append_n(queue* q, queue_element** elems, size_t n);
+
+/* Removes up to max elements from the front of the queue into out, in
+ *   queue order. Returns the number of elements removed, which is less
+ *   than max only if the queue ran empty. Suits elements that are cheap
+ *   to process; whoever drains a batch handles all of it in turn.
+ */
+size_t queue_drain(queue* q, queue_element** out, size_t max);
+
+/*
+ * Moves all the elements of other to the end of q, leaving other empty.
+ * Each queue owns its links, so the elements are copied into links of
+ * q, in time linear in both queues. other must still be destroyed with
+ * queue_destroy.
+ */
+void queue_concat(queue* q, queue* other);
+
+/*
+ * Destroys the queue and frees all of the links it has allocated. The
+ * elements themselves are not freed.
  */
 void queue_destroy(queue* q);
 
@@ -98,8 +121,17 @@ void queue_reverse(queue* q);
 // should return -1 if e1 < e2, 0 if e1 == e2, and 1 if e1 > e2.
 typedef int (*queue_compare)(queue_element* /* e1* */, queue_element* /* e2* */);  // NOLINT
 
-// Sorts the elements of the given queue in place.
+// Sorts the elements of the given queue in place, in O(n log n) time.
+// The sort is stable: elements that compare equal keep their relative
+// order.
 void queue_sort(queue* q, queue_compare qc);
 
+// Sorts the elements of the given queue in place like queue_sort, but
+// splits the queue into up to nthreads runs that are sorted concurrently
+// on sthreads and then merged. The result is the same stable order that
+// queue_sort produces. sthread_init() must have been called; small queues
+// are sorted on the calling thread alone.
+void queue_sort_parallel(queue* q, queue_compare qc, int nthreads);
+
 #endif  // _QUEUE_H_
 
@@ -7,6 +7,7 @@
 #include <config.h>
 
 #include <assert.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -44,8 +45,11 @@ static const int BACKLOG = 5;
 /* Requests really do get this big: */
 static const int REQUEST_MAX_SIZE = 4096;
 
-/* How much of the file to read at a time. */
-static const int BUFFER_SIZE = 4096;
+/* How much of the file to send at a time. */
+static const int BUFFER_SIZE = 65536;
+
+/* Longest headers or error document we send. */
+static const int HEADER_MAX_SIZE = 512;
 
 static const char CRLF[] = "\r\n";
 static const char REQUEST_TERMINATOR[] = "\r\n\r\n";
@@ -60,11 +64,12 @@ void web_handle_connection(int conn, const char *docroot);
 static int web_read_request(int conn, char *request_buf, size_t size);
 static status_t web_parse_request(char *request_buf, char *filename,
                                   size_t filename_len, const char *docroot);
-static void web_send_headers(FILE* stream, status_t status);
+static int web_write_all(int conn, const char *buf, size_t len);
+static void web_send_headers(int conn, status_t status);
 static const char *web_get_status_string(status_t status);
-static status_t web_open_file(const char *filename, FILE **file);
-static void web_send_file(FILE *stream, FILE *file);
-static void web_send_error_doc(FILE *stream, status_t status);
+static status_t web_open_file(const char *filename, int *file);
+static void web_send_file(int conn, int file);
+static void web_send_error_doc(int conn, status_t status);
 
 
 /* Run the webserver. Our host is given, as well as the port to listen
@@ -81,7 +86,7 @@ void web_runloop(const char *host, int port, const char *docroot, int num_thread
   assert(tp != NULL);
 
   while ((next_conn = web_next_connection(listen_socket)) >= 0) {
-    int *conn_ptr = (int *) malloc(next_conn);
+    int *conn_ptr = (int *) malloc(sizeof(int));
     assert(conn_ptr != NULL);
     *conn_ptr = next_conn;
 
@@ -127,7 +132,8 @@ int web_setup_socket(int port) {
 
 /* Get the next incoming connection from the given socket,
  * which should be bound and listening for connections.
- * Will block until a connection is available. Return
+ * Will block the calling thread (only) until a connection is
+ * available. Return
  * -1 on error, 0 or greater on success.
  * This function is not thread safe - multiple threads should
  * not invoke it simultaneously. */
@@ -136,7 +142,7 @@ int web_next_connection(int listen_socket) {
   struct sockaddr_in addr;
   socklen_t len = sizeof(struct sockaddr_in);
 
-  next_conn = accept(listen_socket, (struct sockaddr*)&addr, &len);
+  next_conn = sthread_accept(listen_socket, (struct sockaddr*)&addr, &len);
   if (next_conn == -1)
     perror("sioux: error accepting connections");
 
@@ -145,9 +151,11 @@ int web_next_connection(int listen_socket) {
 
 /* Do all the actual request handling.
  * Read in the request, parse it, and send the requested file
- * back (or send an error back) */
+ * back (or send an error back). All I/O on conn goes through the
+ * sthread I/O calls, so that a slow client holds up only its own
+ * thread; conn is closed when done. */
 void web_handle_connection(int conn, const char *docroot) {
-  FILE *stream = NULL, *file = NULL;
+  int file = -1;
   char *request_buf, *filename;
   status_t status;
   request_buf = malloc(REQUEST_MAX_SIZE);
@@ -160,20 +168,13 @@ void web_handle_connection(int conn, const char *docroot) {
     goto done;
   }
 
-  stream = fdopen(conn, "w");
-  if (stream == NULL) {
-    /* Couldn't open a stream; no way to send a response to the client. */
-    perror("sioux: stream fdopen error");
-    goto done;
-  }
-
   /* Get the filename out of the request. */
   status = web_parse_request(request_buf, filename, REQUEST_MAX_SIZE, docroot);
 
   if (status != STATUS_200_OK) {
     fprintf(stderr, "request error %d\n", status);
-    web_send_headers(stream, status);
-    web_send_error_doc(stream, status);
+    web_send_headers(conn, status);
+    web_send_error_doc(conn, status);
     goto done;
   }
 
@@ -182,20 +183,18 @@ void web_handle_connection(int conn, const char *docroot) {
 
   if (status != STATUS_200_OK) {
     fprintf(stderr, "request error %d\n", status);
-    web_send_headers(stream, status);
-    web_send_error_doc(stream, status);
+    web_send_headers(conn, status);
+    web_send_error_doc(conn, status);
     goto done;
   }
 
   /* Finally - send the file */
-  web_send_headers(stream, status);
-  web_send_file(stream, file);
-  fflush(stream);
-  fclose(file);
+  web_send_headers(conn, status);
+  web_send_file(conn, file);
+  close(file);
 
  done:
-  if (stream != NULL)
-    fclose(stream);
+  close(conn);
   free(request_buf);
   free(filename);
 }
@@ -206,7 +205,7 @@ void web_handle_connection(int conn, const char *docroot) {
 int web_read_request(int conn, char *request_buf, size_t size) {
   ssize_t count = 0, rd;
   /* save 1 char for the '\0' terminator */
-  while ((rd = read(conn, request_buf + count, size-1 - count))) {
+  while ((rd = sthread_read(conn, request_buf + count, size-1 - count))) {
     if (rd == -1) {
       perror("sioux: read error");
       return -1;
@@ -270,53 +269,74 @@ status_t web_parse_request(char *request, char *filename,
   return STATUS_200_OK;
 }
 
+/* Write all len bytes of buf to conn, which may take several writes.
+ * Return 0 on success, -1 on error. */
+int web_write_all(int conn, const char *buf, size_t len) {
+  ssize_t wr;
+
+  while (len > 0) {
+    wr = sthread_write(conn, buf, len);
+    if (wr == -1) {
+      perror("sioux: write error");
+      return -1;
+    }
+    buf += wr;
+    len -= wr;
+  }
+  return 0;
+}
+
 /* Every http response must begin with a set of headers, indicating
  * at least the version of the protocol and code for what happened
  */
-void web_send_headers(FILE *stream, status_t status) {
-  fprintf(stream, "%s %d %s\r\n", HTTP_VERSION, status,
-          web_get_status_string(status));
-  fprintf(stream, "Server: %s\r\n", SERVER);
-  fprintf(stream, "Content-Type: text/html\r\n");
-  fprintf(stream, "Connection: close\r\n");
-  fprintf(stream, CRLF);
+void web_send_headers(int conn, status_t status) {
+  char buf[HEADER_MAX_SIZE];
+  int len;
+
+  len = snprintf(buf, sizeof(buf),
+                 "%s %d %s\r\n"
+                 "Server: %s\r\n"
+                 "Content-Type: text/html\r\n"
+                 "Connection: close\r\n"
+                 "%s", HTTP_VERSION, status, web_get_status_string(status),
+                 SERVER, CRLF);
+  web_write_all(conn, buf, len);
 }
 
 /* Open a file. Return a status code indicating success (200) or failure
  * (anything else) */
-status_t web_open_file(const char *filename, FILE **file) {
-  *file = fopen(filename, "r");
-  if (*file == NULL)
+status_t web_open_file(const char *filename, int *file) {
+  *file = open(filename, O_RDONLY);
+  if (*file == -1)
     return STATUS_404_NOT_FOUND;
   printf("sending file: %s\n", filename);
   return STATUS_200_OK;
 }
 
-/* Given an open stream to send to, and an open file to read from,
- * transfer the file. */
-void web_send_file(FILE *stream, FILE *file) {
-  size_t count;
-  char *buf;
-  buf = (char*)malloc(BUFFER_SIZE);
-  assert(buf != NULL);
-
-  while ((count = fread(buf, 1, BUFFER_SIZE, file)) != 0) {
-    //    fprintf(stderr, "sending file: %d\n", (int)count);
-    count = fwrite(buf, 1, count, stream);
-    if (count == 0) {
+/* Given a connection to send to, and an open file to read from,
+ * transfer the file. The kernel copies it straight from the page cache
+ * to the socket. */
+void web_send_file(int conn, int file) {
+  ssize_t count;
+
+  while ((count = sthread_sendfile(conn, file, NULL, BUFFER_SIZE)) != 0) {
+    if (count == -1) {
       fprintf(stderr, "error sending file\n");
       break;
     }
   }
-
-  free(buf);
 }
 
 /* Send an html document describing the error that occurred. */
-void web_send_error_doc(FILE *stream, status_t status) {
-  fprintf(stream, "<html><head><title>Error %d</title></head>\n", status);
-  fprintf(stream, "<body><h1>Error %d: %s</h1></body></html>\n", status,
-          web_get_status_string(status));
+void web_send_error_doc(int conn, status_t status) {
+  char buf[HEADER_MAX_SIZE];
+  int len;
+
+  len = snprintf(buf, sizeof(buf),
+                 "<html><head><title>Error %d</title></head>\n"
+                 "<body><h1>Error %d: %s</h1></body></html>\n", status,
+                 status, web_get_status_string(status));
+  web_write_all(conn, buf, len);
 }
 
 /* Each status number has an associated string. Return it. */
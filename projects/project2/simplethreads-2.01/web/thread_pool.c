@@ -92,7 +92,9 @@ static void* handle_request(void *arg) {
     // keep trying to get the request until no request
     // in request queue
     while (!queue_is_empty(tp->request_queue)) {
-      // get the next request in request queue
+      // get the next request in request queue; just one, not a batch
+      // with queue_drain, since a slow client would hold up the rest
+      // of the batch while other workers sat idle
       int* conn_ptr;
       queue_remove(tp->request_queue, (queue_element **) &conn_ptr);
 